@@ -7,7 +7,6 @@ int main(int argc, char* argv[])
 {
 	int my_id, nprocs;
 	int buff = 0;
-	MPI_Status status;
 	
 	MPI_Init(&argc, &argv);
 	
@@ -12,7 +12,6 @@
 int main(int argc, char *argv[])	{
 
   int my_id, nprocs;
-  MPI_Status status;
   MPI_Comm new_comm;
   int dims[2] = {4, 3};
   int period[2] = {1, 0};
@@ -13,7 +13,6 @@
 int main(int argc, char *argv[])	{
 
   int my_id, nprocs;
-  MPI_Status status;
 	
   MPI_Init(&argc, &argv);
   MPI_Comm_size(MPI_COMM_WORLD, &nprocs);
@@ -6,8 +6,7 @@
 int main(int argc, char* argv[])
 {
 	int i, my_id, nprocs;
-	int *send_buff, recv_buff;
-	MPI_Status status;
+	int *send_buff = NULL, recv_buff;
 	
 	MPI_Init(&argc, &argv);
 	
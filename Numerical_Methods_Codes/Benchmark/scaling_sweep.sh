@@ -0,0 +1,91 @@
+#!/bin/bash
+# Strong- and weak-scaling sweeps of the numerical programs on the local machine
+# Every program is run with mpirun -np <p> (oversubscribed when p exceeds the cores) for each p in NP_LIST. The benchmark
+# harness of the programs (Common/benchmark.h) appends one CSV record per run to <out_dir>/strong.csv and <out_dir>/weak.csv.
+#   strong scaling: the problem size is fixed
+#   weak scaling: the work per process is fixed, size = size_0 * p^(1/d) for a program whose work grows as size^d
+# Usage: scaling_sweep.sh <bin_dir> [out_dir]
+# Environment: NP_LIST (default "1 2 4 8"), WARMUP (1), TRIALS (5), MPIRUN (mpirun), MPIRUN_FLAGS (--oversubscribe),
+#              OMP_NUM_THREADS (1, one thread per rank)
+set -e
+
+bin_dir=$(cd "${1:?usage: scaling_sweep.sh <bin_dir> [out_dir]}" && pwd)
+out_dir=${2:-scaling}
+NP_LIST=${NP_LIST:-"1 2 4 8"}
+WARMUP=${WARMUP:-1}
+TRIALS=${TRIALS:-5}
+MPIRUN=${MPIRUN:-mpirun}
+MPIRUN_FLAGS=${MPIRUN_FLAGS:---oversubscribe}
+export OMP_NUM_THREADS=${OMP_NUM_THREADS:-1}
+
+mkdir -p "$out_dir"
+out_dir=$(cd "$out_dir" && pwd)
+cd "$out_dir"		# the derivative program writes its result file into the working directory
+rm -f strong.csv weak.csv
+
+# size_0 * p^(1/d), rounded
+scaled_size()	{
+  awk -v s="$1" -v p="$2" -v d="$3" 'BEGIN { printf "%d\n", s * p^(1.0/d) + 0.5 }'
+}
+
+# run <csv> <np> <program> [options]
+run()	{
+  local csv=$1 np=$2 program=$3
+  shift 3
+  echo "$program -np $np $*"
+  $MPIRUN $MPIRUN_FLAGS -np "$np" "$bin_dir/$program" "$@" -warmup "$WARMUP" -trials "$TRIALS" -bench csv -bench-out "$csv" > /dev/null
+}
+
+# the derived datatype programs read a, b and the number of divisions from the root's standard input
+run_stdin()	{
+  local input=$1
+  shift
+  echo "$input" | run "$@"
+}
+
+# sweep <size_0> <d> <program> <size option> [options]
+sweep()	{
+  local size0=$1 d=$2 program=$3 option=$4
+  shift 4
+  for np in $NP_LIST; do
+    run strong.csv "$np" "$program" "$option" "$size0" "$@"
+    size=$(scaled_size "$size0" "$np" "$d")
+    run weak.csv "$np" "$program" "$option" "$size" "$@"
+  done
+}
+
+sweep 512 3 matrix_multiplication_canon -n -engine summa
+sweep 4096 2 matrix_addition -n
+sweep 4096 2 matrix_vector_multiplication -n
+sweep 4096 2 matrix_vector_multiplication -n -layout 2d
+sweep 1000000 1 mpi_parallel_trap_rule_using_reduction -n
+sweep 1000000 1 numerical_derivative_CDS -nx
+sweep 24 3 mpi_multidimensional_integration -n -dim 3 -rule gauss
+sweep 1048576 1 mpi_multidimensional_integration -points -dim 4 -rule qmc
+
+for np in $NP_LIST; do
+  q=$(awk -v p="$np" 'BEGIN { q = int(sqrt(p) + 0.5); print (q*q == p) ? q : 0 }')
+  if [ "$q" -gt 0 ]; then	# cannon's engine needs a square number of processes
+    run strong.csv "$np" matrix_multiplication_canon -n 512
+    size=$(scaled_size 512 "$np" 3)
+    run weak.csv "$np" matrix_multiplication_canon -n "$size"
+  fi
+  for c in $(awk -v p="$np" 'BEGIN { for (c = 1; c <= p; c++) { q = int(sqrt(p / c) + 0.5); if (p % c == 0 && q*q*c == p && c <= q) print c } }'); do
+    run strong.csv "$np" matrix_multiplication_canon -n 512 -engine 2.5d -c "$c"	# p/c = q^2 with c <= q
+    size=$(scaled_size 512 "$np" 3)
+    run weak.csv "$np" matrix_multiplication_canon -n "$size" -engine 2.5d -c "$c"
+  done
+  run_stdin "1.0 3.14159265358 1000000" strong.csv "$np" mpi_parallel_trap_rule_using_derived_datatypes
+  size=$(scaled_size 1000000 "$np" 1)
+  run_stdin "1.0 3.14159265358 $size" weak.csv "$np" mpi_parallel_trap_rule_using_derived_datatypes
+  run_stdin "1.0 3.14159265358 1000000" strong.csv "$np" mpi_parallel_simpson_rule_using_derived_datatypes
+  size=$(( $(scaled_size 500000 "$np" 1) * 2 ))	# the Simpson rule needs an even number of divisions
+  run_stdin "1.0 3.14159265358 $size" weak.csv "$np" mpi_parallel_simpson_rule_using_derived_datatypes
+done
+
+# the adaptive quadrature has no problem size, only the strong scaling at a fixed tolerance is measured
+for np in $NP_LIST; do
+  run strong.csv "$np" mpi_adaptive_quadrature -func peak -tol 1e-12
+done
+
+echo "Results: $out_dir/strong.csv, $out_dir/weak.csv"
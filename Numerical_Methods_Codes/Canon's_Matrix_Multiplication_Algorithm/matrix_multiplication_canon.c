@@ -1,36 +1,374 @@
 // MPI parallelized version of matrix(nxn) multiplication using Canon's algorithm
 // Assumptions:
 // A and B matrices are square matrices and the number of processors used should be a square number.
+// The SUMMA engine (-engine summa) works on any process grid and any N.
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
 #include <time.h>
 #include <math.h>
 #include <mpi.h>
+#include "../Common/block_decomposition.h"
+#include "../Common/benchmark.h"
+#ifdef _OPENMP
+#include <omp.h>
+#else
+#define omp_get_max_threads() 1
+#endif
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define HAVE_X86_SIMD 1
+#endif
 
-void allocate_memory(double **local_A_pp, double **local_B_pp, double **local_C_pp, double **buffer_pp, int local_N, MPI_Comm comm)	{
+/* blocking parameters of the local GEMM kernel */
+#define MR 6			/* rows of the register block (micro-tile) */
+#define NR 16			/* columns of the register block (micro-tile) */
+#define MC 96			/* rows of the packed A panel, kept in L2 cache (multiple of MR) */
+#define KC 256			/* depth of the packed A/B panels */
+#define NC 2048			/* columns of the packed B panel, kept in L3 cache (multiple of NR) */
+
+typedef void (*micro_kernel_t)(int kc, const double *a, const double *b, double *c, int ldc, int mr, int nr);
+
+typedef struct	{		/* run-time options given on the command line */
+  const char *engine;		/* cannon, summa or 2.5d */
+  int c;			/* replication factor (number of layers) of the 2.5D engine */
+  int sweep;			/* 1: run the 2.5D engine for every valid replication factor */
+  int N;			/* size of the global matrix */
+  int nb;			/* panel width of the SUMMA broadcasts */
+  const char *kernel_name;	/* local GEMM micro-kernel: auto, avx512, avx2 or scalar */
+  int overlap;			/* 1: overlap the block shifts with the local multiplication */
+  const char *input;		/* ones, random or file */
+  const char *file_A;		/* matrix files holding the global A and B (input = file) */
+  const char *file_B;
+  const char *file_C;		/* matrix file the global C is written to, NULL for no output */
+  int verify;			/* 1: compare the gathered C against a serial product on the root process */
+  bench_t bench;		/* warm-up runs and timed trials of the cannon/summa/2.5d engines */
+} options_t;
+
+void allocate_memory(double **local_A_pp, double **local_B_pp, double **local_C_pp, double **buffer_A_pp, double **buffer_B_pp, int local_N)	{
 
   *local_A_pp = malloc(local_N * local_N * sizeof(double));
   *local_B_pp = malloc(local_N * local_N * sizeof(double));
-  *buffer_pp = malloc(local_N * local_N * sizeof(double));
+  *buffer_A_pp = malloc(local_N * local_N * sizeof(double));
+  *buffer_B_pp = malloc(local_N * local_N * sizeof(double));	/* spare block used by the double-buffered shifts */
   *local_C_pp = calloc(local_N * local_N, sizeof(double));
   
   return;
 }
 
-void populate_matrices(double *local_A, double *local_B, double *local_C, int local_N, MPI_Comm comm)	{
+/* 2D block datatype: a local_N x local_N block inside a row-major N x N matrix, resized so that block (i,j) starts at displacement i*N+j */
+void create_block_type(int N, int local_N, MPI_Datatype *block_type_p)	{
 
-  int i, j;
+  MPI_Datatype vector_type;
+
+  MPI_Type_vector(local_N, local_N, N, MPI_DOUBLE, &vector_type);
+  MPI_Type_create_resized(vector_type, 0, local_N * sizeof(double), block_type_p);
+  MPI_Type_commit(block_type_p);
+  MPI_Type_free(&vector_type);
+  return;
+}
+
+/* counts and displacements (in units of the block datatype) of the block owned by each process of the grid */
+void block_displacements(int *counts, int *displs, int N, MPI_Comm cannon_comm)	{
+
+  int nprocs, coords[2];
+
+  MPI_Comm_size(cannon_comm, &nprocs);
+  for(int rank = 0; rank < nprocs; rank++)	{
+    MPI_Cart_coords(cannon_comm, rank, 2, coords);
+    counts[rank] = 1;
+    displs[rank] = coords[0] * N + coords[1];
+  }
+  return;
+}
+
+/* binary matrix file: a header of 3 int64 words (magic, rows, columns) followed by the rows x columns doubles in row-major order */
+#define MATRIX_FILE_MAGIC 0x314658495254414DLL	/* "MATRIXF1" in little-endian byte order */
+#define MATRIX_FILE_HEADER (3 * (MPI_Offset)sizeof(int64_t))
+
+/* collective: reads the dimensions stored in the header of a matrix file, returns 0 if the file can not be used */
+int read_matrix_header(const char *file_name, int *rows_p, int *cols_p, MPI_Comm comm)	{
+
+  MPI_File fh;
+  int64_t header[3];
+
+  if (MPI_File_open(comm, file_name, MPI_MODE_RDONLY, MPI_INFO_NULL, &fh) != MPI_SUCCESS) return 0;
+  MPI_File_read_at_all(fh, 0, header, 3, MPI_INT64_T, MPI_STATUS_IGNORE);
+  MPI_File_close(&fh);
+  if (header[0] != MATRIX_FILE_MAGIC || header[1] <= 0 || header[2] <= 0) return 0;
+
+  *rows_p = (int)header[1];
+  *cols_p = (int)header[2];
+  return 1;
+}
+
+/* file view selecting the rows x cols block at (row_s, col_s) of the global m x n matrix, returns the number of local elements */
+int set_block_view(MPI_File fh, int m, int n, int row_s, int rows, int col_s, int cols)	{
+
+  int sizes[2] = {m, n}, subsizes[2] = {rows, cols}, starts[2] = {row_s, col_s};
+  MPI_Datatype block_type;
+
+  if (rows <= 0 || cols <= 0)	{	/* empty block: the process still takes part in the collective call */
+    MPI_File_set_view(fh, MATRIX_FILE_HEADER, MPI_DOUBLE, MPI_DOUBLE, "native", MPI_INFO_NULL);
+    return 0;
+  }
+
+  MPI_Type_create_subarray(2, sizes, subsizes, starts, MPI_ORDER_C, MPI_DOUBLE, &block_type);
+  MPI_Type_commit(&block_type);
+  MPI_File_set_view(fh, MATRIX_FILE_HEADER, MPI_DOUBLE, block_type, "native", MPI_INFO_NULL);
+  MPI_Type_free(&block_type);
+  return rows * cols;
+}
+
+/* collective: every process reads its own block of the global m x n matrix directly from the file */
+void read_matrix_block(const char *file_name, double *local_M, int m, int n, int row_s, int rows, int col_s, int cols, MPI_Comm comm)	{
+
+  MPI_File fh;
+  int count;
+
+  MPI_File_open(comm, file_name, MPI_MODE_RDONLY, MPI_INFO_NULL, &fh);
+  count = set_block_view(fh, m, n, row_s, rows, col_s, cols);
+  MPI_File_read_at_all(fh, 0, local_M, count, MPI_DOUBLE, MPI_STATUS_IGNORE);
+  MPI_File_close(&fh);
+  return;
+}
+
+/* collective: every process writes its own block of the global m x n matrix, the root writes the header */
+void write_matrix_block(const char *file_name, double *local_M, int m, int n, int row_s, int rows, int col_s, int cols, MPI_Comm comm)	{
+
+  MPI_File fh;
+  int my_id, count;
+  int64_t header[3] = {MATRIX_FILE_MAGIC, m, n};
+
+  MPI_Comm_rank(comm, &my_id);
+  MPI_File_open(comm, file_name, MPI_MODE_CREATE | MPI_MODE_WRONLY, MPI_INFO_NULL, &fh);
+  MPI_File_set_size(fh, 0);
+  if (my_id == 0) MPI_File_write_at(fh, 0, header, 3, MPI_INT64_T, MPI_STATUS_IGNORE);
+  count = set_block_view(fh, m, n, row_s, rows, col_s, cols);
+  MPI_File_write_at_all(fh, 0, local_M, count, MPI_DOUBLE, MPI_STATUS_IGNORE);
+  MPI_File_close(&fh);
+  return;
+}
+
+/* serial read of a whole N x N matrix file on one process (used for the verification only) */
+int read_matrix_file(const char *file_name, double *global_mat, int N)	{
+
+  FILE *fptr = fopen(file_name, "rb");
+  int64_t header[3] = {0, 0, 0};
+  size_t count = 0;
+
+  if (fptr == NULL) return 0;
+  if (fread(header, sizeof(int64_t), 3, fptr) == 3 && header[0] == MATRIX_FILE_MAGIC && header[1] == N && header[2] == N)
+    count = fread(global_mat, sizeof(double), (size_t)N * N, fptr);
+  fclose(fptr);
+  return (count == (size_t)N * N);
+}
+
+/* the root builds (random) or reads (file) the global A and B, all processes exit if this fails */
+void build_global_matrices(options_t *opts, double **global_A_pp, double **global_B_pp, MPI_Comm comm)	{
+
+  int i, my_id, ok = 1;
+  int N = opts->N;
+  double *global_A = NULL, *global_B = NULL;
   unsigned int iseed = 0;
   srand(iseed);
 
-  for(i = 0; i < local_N; i++)	{
-    for(j = 0; j < local_N; j++)	{
-      local_A[i*local_N+j] = 1.0; /* 4.0 - (int)(2.0 * rand() / (RAND_MAX + 1.0)); */ // 1.0 is used for sanity check, uncomment to use a random number generator 
-      local_B[i*local_N+j] = 1.0; /* 4.0 - (int)(2.0 * rand() / (RAND_MAX + 1.0)); */ // 1.0 is used for sanity check, uncomment to use a random number generator
-      local_C[i*local_N+j] = 0.0;
+  MPI_Comm_rank(comm, &my_id);
+  if (my_id == 0)	{
+    global_A = malloc((size_t)N * N * sizeof(double));
+    global_B = malloc((size_t)N * N * sizeof(double));
+    if (strcmp(opts->input, "file") == 0)	{
+      ok = read_matrix_file(opts->file_A, global_A, N) && read_matrix_file(opts->file_B, global_B, N);
+      if (!ok) printf("\nCould not read %d x %d matrices from '%s' and '%s'. Exiting!!\n", N, N, opts->file_A, opts->file_B);
+    }
+    else	{
+      for(i = 0; i < N*N; i++)	{
+	global_A[i] = 4.0 - 2.0 * rand() / (RAND_MAX + 1.0);	/* non-integer values: rounding and summation order errors show up */
+	global_B[i] = 4.0 - 2.0 * rand() / (RAND_MAX + 1.0);
+      }
     }
   }
-  
+
+  MPI_Bcast(&ok, 1, MPI_INT, 0, comm);
+  if (!ok)	{
+    MPI_Finalize();
+    exit(0);
+  }
+
+  *global_A_pp = global_A;
+  *global_B_pp = global_B;
+  return;
+}
+
+/* cannon blocks are padded to local_N = ceil(N/q): the balanced (ragged) rows x cols block of a process sits in the top-left */
+/* corner of a local_N x local_N buffer and the rest is zero, so every shift moves blocks of the same size and the padded */
+/* zeros do not change the product. In the padded global layout, global row/column g moves to block*local_N + offset */
+int padded_index(int N, int q, int local_N, int g)	{
+
+  int b = block_owner(N, q, g), start, size;
+
+  block_range(N, q, b, &start, &size);
+  return b * local_N + (g - start);
+}
+
+/* root: row-major N x N matrix to the (q*local_N) x (q*local_N) padded layout (reverse = 0) or back (reverse = 1) */
+void pad_global_matrix(double *global_M, double *padded_M, int N, int q, int local_N, int reverse)	{
+
+  int i, j, Np = q * local_N;
+
+  if (!reverse) memset(padded_M, 0, (size_t)Np * Np * sizeof(double));
+  for(i = 0; i < N; i++)	{
+    int pi = padded_index(N, q, local_N, i);
+    for(j = 0; j < N; j++)	{
+      if (reverse)	global_M[(size_t)i*N+j] = padded_M[(size_t)pi*Np+padded_index(N, q, local_N, j)];
+      else		padded_M[(size_t)pi*Np+padded_index(N, q, local_N, j)] = global_M[(size_t)i*N+j];
+    }
+  }
+  return;
+}
+
+/* in place: a contiguous rows x cols block is spread to the leading dimension local_N and zero-padded */
+void pad_block(double *M, int rows, int cols, int local_N)	{
+
+  int i;
+
+  for(i = rows-1; i >= 0; i--)	{	/* backwards, rows only move to higher addresses */
+    memmove(&M[(size_t)i*local_N], &M[(size_t)i*cols], cols * sizeof(double));
+    memset(&M[(size_t)i*local_N+cols], 0, (local_N - cols) * sizeof(double));
+  }
+  memset(&M[(size_t)rows*local_N], 0, (size_t)(local_N - rows) * local_N * sizeof(double));
+  return;
+}
+
+/* actual (unpadded) block of a process of the q x q cannon grid */
+void cannon_block_range(int N, MPI_Comm cannon_comm, int *row_s, int *rows, int *col_s, int *cols)	{
+
+  int dims[2], periods[2], coords[2];
+
+  MPI_Cart_get(cannon_comm, 2, dims, periods, coords);
+  block_range(N, dims[0], coords[0], row_s, rows);
+  block_range(N, dims[1], coords[1], col_s, cols);
+  return;
+}
+
+/* collective: every process writes the actual part of its padded block of C */
+void write_cannon_block(const char *file_name, double *local_C, int N, int local_N, MPI_Comm cannon_comm)	{
+
+  int row_s, rows, col_s, cols, i;
+  double *block;
+
+  cannon_block_range(N, cannon_comm, &row_s, &rows, &col_s, &cols);
+  block = malloc(((size_t)rows * cols + 1) * sizeof(double));
+  for(i = 0; i < rows; i++) memcpy(&block[(size_t)i*cols], &local_C[(size_t)i*local_N], cols * sizeof(double));
+  write_matrix_block(file_name, block, N, N, row_s, rows, col_s, cols, cannon_comm);
+  free(block);
+  return;
+}
+
+/* fills the local blocks of A and B; for the file input every process reads its own 2D block with MPI-IO, for the random */
+/* input the root builds the global matrices and scatters the 2D blocks */
+/* the global matrices are handed back on the root (for verification) and have to be freed by the caller */
+void populate_matrices(double *local_A, double *local_B, double *local_C, int local_N, options_t *opts, double **global_A_pp, double **global_B_pp, MPI_Comm cannon_comm)	{
+
+  int i, j, my_id, nprocs, q, row_s, rows, col_s, cols;
+  int *counts = NULL, *displs = NULL;
+  int N = opts->N;
+  double *padded_A = NULL, *padded_B = NULL;
+  MPI_Datatype block_type;
+
+  MPI_Comm_rank(cannon_comm, &my_id);
+  MPI_Comm_size(cannon_comm, &nprocs);
+  q = (int)(sqrt((double)nprocs) + 0.5);
+  cannon_block_range(N, cannon_comm, &row_s, &rows, &col_s, &cols);
+
+  for(i = 0; i < local_N*local_N; i++) local_C[i] = 0.0;
+
+  if (strcmp(opts->input, "ones") == 0)	{	/* 1.0 is used for sanity check, every element of C should be equal to N */
+    for(i = 0; i < local_N; i++)	{
+      for(j = 0; j < local_N; j++)	{
+	local_A[i*local_N+j] = (i < rows && j < cols) ? 1.0 : 0.0;
+	local_B[i*local_N+j] = (i < rows && j < cols) ? 1.0 : 0.0;
+      }
+    }
+    return;
+  }
+
+  if (strcmp(opts->input, "file") == 0)	{
+    read_matrix_block(opts->file_A, local_A, N, N, row_s, rows, col_s, cols, cannon_comm);
+    read_matrix_block(opts->file_B, local_B, N, N, row_s, rows, col_s, cols, cannon_comm);
+    pad_block(local_A, rows, cols, local_N);
+    pad_block(local_B, rows, cols, local_N);
+    if (opts->verify) build_global_matrices(opts, global_A_pp, global_B_pp, cannon_comm);
+    return;
+  }
+
+  build_global_matrices(opts, global_A_pp, global_B_pp, cannon_comm);
+  if (my_id == 0)	{	/* the scatter works on the padded layout, where all blocks have the same size */
+    counts = malloc(nprocs * sizeof(int));
+    displs = malloc(nprocs * sizeof(int));
+    block_displacements(counts, displs, q*local_N, cannon_comm);
+    padded_A = malloc((size_t)q * local_N * q * local_N * sizeof(double));
+    padded_B = malloc((size_t)q * local_N * q * local_N * sizeof(double));
+    pad_global_matrix(*global_A_pp, padded_A, N, q, local_N, 0);
+    pad_global_matrix(*global_B_pp, padded_B, N, q, local_N, 0);
+  }
+
+  create_block_type(q*local_N, local_N, &block_type);
+  MPI_Scatterv(padded_A, counts, displs, block_type, local_A, local_N*local_N, MPI_DOUBLE, 0, cannon_comm);
+  MPI_Scatterv(padded_B, counts, displs, block_type, local_B, local_N*local_N, MPI_DOUBLE, 0, cannon_comm);
+  MPI_Type_free(&block_type);
+
+  free(padded_A);
+  free(padded_B);
+  free(counts);
+  free(displs);
+  return;
+}
+
+/* gathers the local blocks of C into a row-major global matrix on the root */
+void gather_matrix(double *local_C, double *global_C, int N, int local_N, MPI_Comm cannon_comm)	{
+
+  int my_id, nprocs, q;
+  int *counts = NULL, *displs = NULL;
+  double *padded_C = NULL;
+  MPI_Datatype block_type;
+
+  MPI_Comm_rank(cannon_comm, &my_id);
+  MPI_Comm_size(cannon_comm, &nprocs);
+  q = (int)(sqrt((double)nprocs) + 0.5);
+  if (my_id == 0)	{
+    counts = malloc(nprocs * sizeof(int));
+    displs = malloc(nprocs * sizeof(int));
+    block_displacements(counts, displs, q*local_N, cannon_comm);
+    padded_C = malloc((size_t)q * local_N * q * local_N * sizeof(double));
+  }
+
+  create_block_type(q*local_N, local_N, &block_type);
+  MPI_Gatherv(local_C, local_N*local_N, MPI_DOUBLE, padded_C, counts, displs, block_type, 0, cannon_comm);
+  MPI_Type_free(&block_type);
+  if (my_id == 0) pad_global_matrix(global_C, padded_C, N, q, local_N, 1);
+
+  free(padded_C);
+  free(counts);
+  free(displs);
+  return;
+}
+
+/* initial alignment of cannon algorithm: row i of A is shifted left by i blocks and column j of B is shifted up by j blocks */
+/* a non-zero offset starts the shift cycle at a later step (used by the layers of the 2.5D algorithm) */
+void skew_matrices(double *local_A, double *local_B, int local_N, int offset, MPI_Comm cannon_comm)	{
+
+  MPI_Status status;
+  int my_id, coords[2], source, dest;
+
+  MPI_Comm_rank(cannon_comm, &my_id);
+  MPI_Cart_coords(cannon_comm, my_id, 2, coords);
+
+  MPI_Cart_shift(cannon_comm, 1, -(coords[0] + offset), &source, &dest);
+  MPI_Sendrecv_replace(local_A, local_N*local_N, MPI_DOUBLE, dest, 3, source, 3, cannon_comm, &status);
+  MPI_Cart_shift(cannon_comm, 0, -(coords[1] + offset), &source, &dest);
+  MPI_Sendrecv_replace(local_B, local_N*local_N, MPI_DOUBLE, dest, 4, source, 4, cannon_comm, &status);
   return;
 }
 
@@ -46,16 +384,37 @@ void print_matrix(double *local_mat, int local_N)	{
   return;
 }
  
-void deallocate_memory(double *local_A, double *local_B, double *local_C, double *buffer, MPI_Comm comm)	{
+void deallocate_memory(double *local_A, double *local_B, double *local_C, double *buffer_A, double *buffer_B)	{
 
   free(local_A);
   free(local_B);
-  free(buffer);
+  free(buffer_A);
+  free(buffer_B);
   free(local_C);
   return;
 }
 
-void matrix_mult(double *local_A, double *local_B, double *local_C, int local_N)	{
+void parse_arguments(int argc, char *argv[], options_t *opts)	{
+
+  for(int i = 1; i < argc; i++)	{
+    if (strcmp(argv[i], "-overlap") == 0)		opts->overlap = 1;
+    else if (strcmp(argv[i], "-verify") == 0)		opts->verify = 1;
+    else if (strcmp(argv[i], "-sweep") == 0)		opts->sweep = 1;
+    else if (i == argc-1)				break;
+    else if (strcmp(argv[i], "-engine") == 0)	opts->engine = argv[++i];
+    else if (strcmp(argv[i], "-n") == 0)		opts->N = atoi(argv[++i]);
+    else if (strcmp(argv[i], "-nb") == 0)		opts->nb = atoi(argv[++i]);
+    else if (strcmp(argv[i], "-c") == 0)		opts->c = atoi(argv[++i]);
+    else if (strcmp(argv[i], "-kernel") == 0)	opts->kernel_name = argv[++i];
+    else if (strcmp(argv[i], "-input") == 0)	opts->input = argv[++i];
+    else if (strcmp(argv[i], "-a") == 0)		opts->file_A = argv[++i];
+    else if (strcmp(argv[i], "-b") == 0)		opts->file_B = argv[++i];
+    else if (strcmp(argv[i], "-o") == 0)		opts->file_C = argv[++i];
+  }
+  return;
+}
+
+void matrix_mult_naive(double *local_A, double *local_B, double *local_C, int local_N)	{
 
   int i, j, k;
 
@@ -67,100 +426,823 @@ void matrix_mult(double *local_A, double *local_B, double *local_C, int local_N)
   return;
 }
 
-int main(int argc, char *argv[])	{
+/* adds the mr x nr valid part of a computed micro-tile into C */
+static void add_micro_tile(const double *tile, double *c, int ldc, int mr, int nr)	{
+
+  for(int i = 0; i < mr; i++)
+    for(int j = 0; j < nr; j++)
+      c[i*ldc+j] += tile[i*NR+j];
+
+  return;
+}
+
+/* portable micro-kernel: C(mr x nr) += A_panel(mr x kc) * B_panel(kc x nr) */
+static void micro_kernel_scalar(int kc, const double *a, const double *b, double *c, int ldc, int mr, int nr)	{
+
+  double tile[MR*NR] = {0.0};
+
+  for(int k = 0; k < kc; k++)	{
+    for(int i = 0; i < MR; i++)	{
+      double a_ik = a[k*MR+i];
+      for(int j = 0; j < NR; j++)
+	tile[i*NR+j] += a_ik * b[k*NR+j];
+    }
+  }
+
+  add_micro_tile(tile, c, ldc, mr, nr);
+  return;
+}
+
+#ifdef HAVE_X86_SIMD
+/* AVX2 micro-kernel: the 6 x 16 tile is computed as two 6 x 8 halves, each held in 12 ymm accumulators */
+__attribute__((target("avx2,fma")))
+static void micro_kernel_avx2(int kc, const double *a, const double *b, double *c, int ldc, int mr, int nr)	{
+
+  __m256d acc[MR][2];
+  double tile[MR*NR];
+  int i, j, h;
+  int full = (mr == MR && nr == NR);
+
+  for(h = 0; h < NR; h += 8)	{
+    for(i = 0; i < MR; i++)
+      for(j = 0; j < 2; j++)
+	acc[i][j] = _mm256_setzero_pd();
+
+    for(int k = 0; k < kc; k++)	{
+      __m256d b0 = _mm256_load_pd(&b[k*NR+h]);
+      __m256d b1 = _mm256_load_pd(&b[k*NR+h+4]);
+      for(i = 0; i < MR; i++)	{
+	__m256d a_ik = _mm256_broadcast_sd(&a[k*MR+i]);
+	acc[i][0] = _mm256_fmadd_pd(a_ik, b0, acc[i][0]);
+	acc[i][1] = _mm256_fmadd_pd(a_ik, b1, acc[i][1]);
+      }
+    }
+
+    for(i = 0; i < MR; i++)	{
+      for(j = 0; j < 2; j++)	{
+	if (full)	_mm256_storeu_pd(&c[i*ldc+h+4*j], _mm256_add_pd(_mm256_loadu_pd(&c[i*ldc+h+4*j]), acc[i][j]));
+	else		_mm256_storeu_pd(&tile[i*NR+h+4*j], acc[i][j]);
+      }
+    }
+  }
+
+  if (!full)	add_micro_tile(tile, c, ldc, mr, nr);
+  return;
+}
+
+/* AVX-512 micro-kernel: 6 x 16 tile held in 12 zmm accumulators */
+__attribute__((target("avx512f")))
+static void micro_kernel_avx512(int kc, const double *a, const double *b, double *c, int ldc, int mr, int nr)	{
+
+  __m512d acc[MR][2];
+  double tile[MR*NR];
+  int i, j;
+
+  for(i = 0; i < MR; i++)
+    for(j = 0; j < 2; j++)
+      acc[i][j] = _mm512_setzero_pd();
+
+  for(int k = 0; k < kc; k++)	{
+    __m512d b0 = _mm512_load_pd(&b[k*NR]);
+    __m512d b1 = _mm512_load_pd(&b[k*NR+8]);
+    for(i = 0; i < MR; i++)	{
+      __m512d a_ik = _mm512_set1_pd(a[k*MR+i]);
+      acc[i][0] = _mm512_fmadd_pd(a_ik, b0, acc[i][0]);
+      acc[i][1] = _mm512_fmadd_pd(a_ik, b1, acc[i][1]);
+    }
+  }
+
+  if (mr == MR && nr == NR)	{
+    for(i = 0; i < MR; i++)
+      for(j = 0; j < 2; j++)
+	_mm512_storeu_pd(&c[i*ldc+8*j], _mm512_add_pd(_mm512_loadu_pd(&c[i*ldc+8*j]), acc[i][j]));
+  }
+  else	{
+    for(i = 0; i < MR; i++)
+      for(j = 0; j < 2; j++)
+	_mm512_storeu_pd(&tile[i*NR+8*j], acc[i][j]);
+    add_micro_tile(tile, c, ldc, mr, nr);
+  }
+  return;
+}
+#endif
+
+/* picks the widest micro-kernel supported by the running CPU, unless the user forces one */
+micro_kernel_t select_micro_kernel(const char *name, const char **chosen_p)	{
+
+#ifdef HAVE_X86_SIMD
+  __builtin_cpu_init();
+  int has_avx512 = __builtin_cpu_supports("avx512f");
+  int has_avx2 = __builtin_cpu_supports("avx2") && __builtin_cpu_supports("fma");
+
+  if ((strcmp(name, "auto") == 0 || strcmp(name, "avx512") == 0) && has_avx512)	{
+    *chosen_p = "avx512";
+    return micro_kernel_avx512;
+  }
+  if ((strcmp(name, "auto") == 0 || strcmp(name, "avx512") == 0 || strcmp(name, "avx2") == 0) && has_avx2)	{
+    *chosen_p = "avx2";
+    return micro_kernel_avx2;
+  }
+#endif
+  *chosen_p = "scalar";
+  return micro_kernel_scalar;
+}
+
+/* copies a mc x kc block of A into row-panels of MR rows, zero-padding the last panel */
+static void pack_A(const double *A, int lda, int mc, int kc, double *A_packed)	{
+
+  for(int ip = 0; ip < mc; ip += MR)	{
+    int mr = (mc - ip < MR) ? mc - ip : MR;
+    for(int k = 0; k < kc; k++)	{
+      for(int i = 0; i < mr; i++)	A_packed[k*MR+i] = A[(ip+i)*lda+k];
+      for(int i = mr; i < MR; i++)	A_packed[k*MR+i] = 0.0;
+    }
+    A_packed += MR * kc;
+  }
+  return;
+}
+
+/* copies a kc x nc block of B into column-panels of NR columns, zero-padding the last panel */
+static void pack_B(const double *B, int ldb, int kc, int nc, double *B_packed)	{
+
+  for(int jp = 0; jp < nc; jp += NR)	{
+    int nr = (nc - jp < NR) ? nc - jp : NR;
+    for(int k = 0; k < kc; k++)	{
+      for(int j = 0; j < nr; j++)	B_packed[k*NR+j] = B[k*ldb+jp+j];
+      for(int j = nr; j < NR; j++)	B_packed[k*NR+j] = 0.0;
+    }
+    B_packed += NR * kc;
+  }
+  return;
+}
+
+/* packing buffers of gemm, allocated at the first call and kept alive across the shift steps, freed by gemm_free_buffers */
+static double *B_packed = NULL;
+static _Thread_local double *A_packed = NULL;	/* each thread packs its own A panel */
+
+/* cache-blocked local GEMM, C(m x n) += A(m x k) * B(k x n), on packed panels of A (L2) and B (L3) */
+/* with OpenMP, the threads pack the shared B panel together and then work on separate row blocks (ic) of C */
+void gemm(int m, int n, int k, const double *A, int lda, const double *B, int ldb, double *C, int ldc, micro_kernel_t kernel)	{
+
+  if (B_packed == NULL)
+    B_packed = aligned_alloc(64, KC * NC * sizeof(double));
+
+#pragma omp parallel
+  {
+    if (A_packed == NULL)
+      A_packed = aligned_alloc(64, MC * KC * sizeof(double));
+
+    for(int jc = 0; jc < n; jc += NC)	{
+      int nc = (n - jc < NC) ? n - jc : NC;
+      for(int pc = 0; pc < k; pc += KC)	{
+	int kc = (k - pc < KC) ? k - pc : KC;
+#pragma omp for
+	for(int jp = 0; jp < nc; jp += NR)
+	  pack_B(&B[pc*ldb+jc+jp], ldb, kc, (nc - jp < NR) ? nc - jp : NR, &B_packed[jp*kc]);
+
+#pragma omp for schedule(dynamic)
+	for(int ic = 0; ic < m; ic += MC)	{
+	  int mc = (m - ic < MC) ? m - ic : MC;
+	  pack_A(&A[ic*lda+pc], lda, mc, kc, A_packed);
+	  for(int jr = 0; jr < nc; jr += NR)	{
+	    int nr = (nc - jr < NR) ? nc - jr : NR;
+	    for(int ir = 0; ir < mc; ir += MR)	{
+	      int mr = (mc - ir < MR) ? mc - ir : MR;
+	      kernel(kc, &A_packed[ir*kc], &B_packed[jr*kc], &C[(ic+ir)*ldc+jc+jr], ldc, mr, nr);
+	    }
+	  }
+	}
+      }
+    }
+  }
+
+  return;
+}
+
+/* frees the packing buffers of every thread (the same thread team as in gemm) */
+void gemm_free_buffers(void)	{
+
+#pragma omp parallel
+  {
+    free(A_packed);
+    A_packed = NULL;
+  }
+  free(B_packed);
+  B_packed = NULL;
+  return;
+}
+
+void matrix_mult(double *local_A, double *local_B, double *local_C, int local_N, micro_kernel_t kernel)	{
+
+  gemm(local_N, local_N, local_N, local_A, local_N, local_B, local_N, local_C, local_N, kernel);
+  return;
+}
+
+/* compares the blocked kernel against the naive triple loop on random blocks, returns the max relative error */
+double check_matrix_mult(int n, micro_kernel_t kernel)	{
+
+  double *A = calloc(n * n, sizeof(double));
+  double *B = calloc(n * n, sizeof(double));
+  double *C_ref = calloc(n * n, sizeof(double));
+  double *C = calloc(n * n, sizeof(double));
+  double err = 0.0;
+  int i;
+
+  for(i = 0; i < n*n; i++)	{
+    A[i] = 2.0 * rand() / RAND_MAX - 1.0;
+    B[i] = 2.0 * rand() / RAND_MAX - 1.0;
+  }
+
+  matrix_mult_naive(A, B, C_ref, n);
+  matrix_mult(A, B, C, n, kernel);
+
+  for(i = 0; i < n*n; i++)
+    err = fmax(err, fabs(C[i] - C_ref[i]) / (fabs(C_ref[i]) + 1.0));
+
+  free(A);
+  free(B);
+  free(C_ref);
+  free(C);
+  return err;
+}
+
+/* shift cycle of cannon algorithm with blocking shifts, returns the time spent in the local multiplication */
+double cannon_shift_blocking(double **local_A_pp, double **local_B_pp, double *local_C, double **buffer_pp, int local_N, int nsteps, MPI_Comm cannon_comm, micro_kernel_t kernel)	{
 
-  int my_id, nprocs;
   MPI_Status status;
-  MPI_Comm cannon_comm;
+  int i, left, right, up, down;
+  double *temp, t0, compute_time = 0.0;
 
-  int i, j, local_N;
-  int dims[2], periods[2];
-  int left, right, up, down;
+  /* obtain ranks of neighbouring processes */
+  MPI_Cart_shift(cannon_comm, 1, -1, &right, &left);	/* A moves left along its process row */
+  MPI_Cart_shift(cannon_comm, 0, -1, &down, &up);	/* B moves up along its process column */
+
+  for(i = 0; i < nsteps; i++)	{
+    t0 = MPI_Wtime();
+    matrix_mult(*local_A_pp, *local_B_pp, local_C, local_N, kernel);
+    compute_time += MPI_Wtime() - t0;
+    if (i == nsteps-1) break;
+
+    /* communication calls */
+    MPI_Sendrecv(*local_A_pp, local_N*local_N, MPI_DOUBLE, left, 1, *buffer_pp, local_N*local_N, MPI_DOUBLE, right, 1, cannon_comm, &status);
+    temp = *buffer_pp;
+    *buffer_pp = *local_A_pp;
+    *local_A_pp = temp;
+    MPI_Sendrecv(*local_B_pp, local_N*local_N, MPI_DOUBLE, up, 2, *buffer_pp, local_N*local_N, MPI_DOUBLE, down, 2, cannon_comm, &status);
+    temp = *buffer_pp;
+    *buffer_pp = *local_B_pp;
+    *local_B_pp = temp;
+  }
+
+  return compute_time;
+}
+
+/* double-buffered shift cycle: the next A/B blocks are received into spare buffers while the current blocks are multiplied */
+double cannon_shift_overlapped(double **local_A_pp, double **local_B_pp, double *local_C, double **buffer_A_pp, double **buffer_B_pp, int local_N, int nsteps, MPI_Comm cannon_comm, micro_kernel_t kernel)	{
+
+  MPI_Request requests[4];
+  int i, left, right, up, down;
+  double *temp, t0, compute_time = 0.0;
+
+  MPI_Cart_shift(cannon_comm, 1, -1, &right, &left);	/* A moves left along its process row */
+  MPI_Cart_shift(cannon_comm, 0, -1, &down, &up);	/* B moves up along its process column */
+
+  for(i = 0; i < nsteps; i++)	{
+    if (i < nsteps-1)	{	/* post the shifts for the next step before computing */
+      MPI_Irecv(*buffer_A_pp, local_N*local_N, MPI_DOUBLE, right, 1, cannon_comm, &requests[0]);
+      MPI_Irecv(*buffer_B_pp, local_N*local_N, MPI_DOUBLE, down, 2, cannon_comm, &requests[1]);
+      MPI_Isend(*local_A_pp, local_N*local_N, MPI_DOUBLE, left, 1, cannon_comm, &requests[2]);
+      MPI_Isend(*local_B_pp, local_N*local_N, MPI_DOUBLE, up, 2, cannon_comm, &requests[3]);
+    }
+
+    t0 = MPI_Wtime();
+    matrix_mult(*local_A_pp, *local_B_pp, local_C, local_N, kernel);
+    compute_time += MPI_Wtime() - t0;
+    if (i == nsteps-1) break;
+
+    MPI_Waitall(4, requests, MPI_STATUSES_IGNORE);
+    temp = *buffer_A_pp;
+    *buffer_A_pp = *local_A_pp;
+    *local_A_pp = temp;
+    temp = *buffer_B_pp;
+    *buffer_B_pp = *local_B_pp;
+    *local_B_pp = temp;
+  }
+
+  return compute_time;
+}
+
+/* root sends each process its (possibly ragged) 2D block of a row-major N x N matrix using a subarray datatype */
+void scatter_ragged_blocks(double *global_M, double *local_M, int N, MPI_Comm grid_comm)	{
+
+  int my_id, nprocs, dims[2], periods[2], coords[2];
+  int sizes[2] = {N, N}, subsizes[2], starts[2];
+  MPI_Datatype block_type;
+
+  MPI_Comm_rank(grid_comm, &my_id);
+  MPI_Comm_size(grid_comm, &nprocs);
+  MPI_Cart_get(grid_comm, 2, dims, periods, coords);
+
+  if (my_id == 0)	{
+    for(int rank = 0; rank < nprocs; rank++)	{
+      MPI_Cart_coords(grid_comm, rank, 2, coords);
+      block_range(N, dims[0], coords[0], &starts[0], &subsizes[0]);
+      block_range(N, dims[1], coords[1], &starts[1], &subsizes[1]);
+      if (subsizes[0] == 0 || subsizes[1] == 0) continue;
+      MPI_Type_create_subarray(2, sizes, subsizes, starts, MPI_ORDER_C, MPI_DOUBLE, &block_type);
+      MPI_Type_commit(&block_type);
+      if (rank == 0)	MPI_Sendrecv(global_M, 1, block_type, 0, 5, local_M, subsizes[0]*subsizes[1], MPI_DOUBLE, 0, 5, grid_comm, MPI_STATUS_IGNORE);
+      else		MPI_Send(global_M, 1, block_type, rank, 5, grid_comm);
+      MPI_Type_free(&block_type);
+    }
+  }
+  else	{
+    block_range(N, dims[0], coords[0], &starts[0], &subsizes[0]);
+    block_range(N, dims[1], coords[1], &starts[1], &subsizes[1]);
+    if (subsizes[0] > 0 && subsizes[1] > 0)
+      MPI_Recv(local_M, subsizes[0]*subsizes[1], MPI_DOUBLE, 0, 5, grid_comm, MPI_STATUS_IGNORE);
+  }
+  return;
+}
+
+/* reverse of scatter_ragged_blocks: root collects every 2D block into a row-major N x N matrix */
+void gather_ragged_blocks(double *local_M, double *global_M, int N, MPI_Comm grid_comm)	{
+
+  int my_id, nprocs, dims[2], periods[2], coords[2];
+  int sizes[2] = {N, N}, subsizes[2], starts[2];
+  MPI_Datatype block_type;
+
+  MPI_Comm_rank(grid_comm, &my_id);
+  MPI_Comm_size(grid_comm, &nprocs);
+  MPI_Cart_get(grid_comm, 2, dims, periods, coords);
+
+  if (my_id == 0)	{
+    for(int rank = 0; rank < nprocs; rank++)	{
+      MPI_Cart_coords(grid_comm, rank, 2, coords);
+      block_range(N, dims[0], coords[0], &starts[0], &subsizes[0]);
+      block_range(N, dims[1], coords[1], &starts[1], &subsizes[1]);
+      if (subsizes[0] == 0 || subsizes[1] == 0) continue;
+      MPI_Type_create_subarray(2, sizes, subsizes, starts, MPI_ORDER_C, MPI_DOUBLE, &block_type);
+      MPI_Type_commit(&block_type);
+      if (rank == 0)	MPI_Sendrecv(local_M, subsizes[0]*subsizes[1], MPI_DOUBLE, 0, 6, global_M, 1, block_type, 0, 6, grid_comm, MPI_STATUS_IGNORE);
+      else		MPI_Recv(global_M, 1, block_type, rank, 6, grid_comm, MPI_STATUS_IGNORE);
+      MPI_Type_free(&block_type);
+    }
+  }
+  else	{
+    block_range(N, dims[0], coords[0], &starts[0], &subsizes[0]);
+    block_range(N, dims[1], coords[1], &starts[1], &subsizes[1]);
+    if (subsizes[0] > 0 && subsizes[1] > 0)
+      MPI_Send(local_M, subsizes[0]*subsizes[1], MPI_DOUBLE, 0, 6, grid_comm);
+  }
+  return;
+}
+
+/* SUMMA: for each panel of nb global columns of A / rows of B, the owning process column broadcasts its A panel along the */
+/* process rows and the owning process row broadcasts its B panel along the process columns, then C += A_panel * B_panel */
+/* all three local blocks are m x n with m/n the (ragged) row/column block sizes of the process */
+double summa_multiply(double *local_A, double *local_B, double *local_C, int N, int nb, MPI_Comm grid_comm, MPI_Comm row_comm, MPI_Comm col_comm, micro_kernel_t kernel)	{
+
+  int dims[2], periods[2], coords[2];
+  int row_s, m, col_s, n, owner_row, owner_col, owner_s, owner_size, k, w, i, j;
+  double *A_panel, *B_panel, t0, compute_time = 0.0;
+
+  MPI_Cart_get(grid_comm, 2, dims, periods, coords);
+  block_range(N, dims[0], coords[0], &row_s, &m);
+  block_range(N, dims[1], coords[1], &col_s, &n);
+
+  A_panel = malloc((m * nb + 1) * sizeof(double));
+  B_panel = malloc((nb * n + 1) * sizeof(double));
+
+  for(k = 0; k < N; k += w)	{
+    /* the panel may not cross a block boundary of either the A columns or the B rows */
+    owner_col = block_owner(N, dims[1], k);
+    owner_row = block_owner(N, dims[0], k);
+    w = nb;
+    block_range(N, dims[1], owner_col, &owner_s, &owner_size);
+    if (owner_s + owner_size - k < w) w = owner_s + owner_size - k;
+    block_range(N, dims[0], owner_row, &owner_s, &owner_size);
+    if (owner_s + owner_size - k < w) w = owner_s + owner_size - k;
+
+    if (coords[1] == owner_col)	{
+      for(i = 0; i < m; i++)
+	for(j = 0; j < w; j++)
+	  A_panel[i*w+j] = local_A[i*n+(k-col_s)+j];
+    }
+    if (coords[0] == owner_row)
+      memcpy(B_panel, &local_B[(k-row_s)*n], w * n * sizeof(double));
+
+    MPI_Bcast(A_panel, m*w, MPI_DOUBLE, owner_col, row_comm);	/* rank in row_comm = column coordinate */
+    MPI_Bcast(B_panel, w*n, MPI_DOUBLE, owner_row, col_comm);	/* rank in col_comm = row coordinate */
+
+    t0 = MPI_Wtime();
+    gemm(m, n, w, A_panel, w, B_panel, n, local_C, n, kernel);
+    compute_time += MPI_Wtime() - t0;
+  }
+
+  free(A_panel);
+  free(B_panel);
+  return compute_time;
+}
+
+/* achieved local GEMM rate of each process, printed by the root */
+void report_gflops(double gflops, MPI_Comm comm)	{
+
+  int my_id, nprocs;
+  double* rank_gflops = NULL;
+
+  MPI_Comm_rank(comm, &my_id);
+  MPI_Comm_size(comm, &nprocs);
+  if (my_id == 0) rank_gflops = malloc(nprocs * sizeof(double));
+  MPI_Gather(&gflops, 1, MPI_DOUBLE, rank_gflops, 1, MPI_DOUBLE, 0, comm);
+  if (my_id == 0)	{
+    for(int i = 0; i < nprocs; i++)	printf("Local GEMM rate on process %d = %lf GFLOP/s\n", i, rank_gflops[i]);
+    free(rank_gflops);
+  }
+  return;
+}
+
+/* root only: prints small results and optionally checks C against a serial product (or against N for the ones input) */
+/* the reference is the naive triple loop, independent of the blocked kernel and its packing */
+void print_and_verify(double *global_A, double *global_B, double *global_C, options_t *opts)	{
+
+  int i, j, N = opts->N;
+  double error = 0.0;
 
-  int N = 16;			/* size of the global matrix */
+  if (N <= 16)	{	/* printing is limited to small matrices */
+    printf("\n---------Printing global matrix-C---------\n");	
+    for(i = 0; i < N; i++)	{
+      for(j = 0; j < N; j++)	{
+	printf("%lf ", global_C[i*N+j]);
+      }
+      printf("\n");
+    }
+  }
+
+  if (opts->verify)	{
+    if (global_A == NULL)	{
+      for(i = 0; i < N*N; i++) error = fmax(error, fabs(global_C[i] - N));
+    }
+    else	{
+      double *C_ref = calloc((size_t)N * N, sizeof(double));
+      matrix_mult_naive(global_A, global_B, C_ref, N);
+      for(i = 0; i < N*N; i++) error = fmax(error, fabs(global_C[i] - C_ref[i]) / (fabs(C_ref[i]) + 1.0));
+      free(C_ref);
+    }
+    printf("\nMax relative error against the serial product = %e\n", error);
+  }
+  return;
+}
+
+void run_cannon(options_t *opts, micro_kernel_t kernel)	{
+
+  int my_id, nprocs, local_N;
+  int dims[2], periods[2];
+  MPI_Comm cannon_comm;
 
-  double *local_A, *local_B, *local_C, *buffer, *temp;
+  double *local_A, *local_B, *local_C, *buffer_A, *buffer_B, *initial_A, *initial_B;
+  double* global_A = NULL;
+  double* global_B = NULL;
   double* global_C = NULL;
-  double start_time, end_time;
+  double compute_time = 0.0;
+  bench_stats_t stats;
 
-  MPI_Init(&argc, &argv);
-  MPI_Comm_rank(MPI_COMM_WORLD, &my_id);
   MPI_Comm_size(MPI_COMM_WORLD, &nprocs);
+  MPI_Comm_rank(MPI_COMM_WORLD, &my_id);
 
   /* initialize new communicator */
   dims[0] = dims[1] = 0;	/* allowing MPI to auto-allocate the process in each direction */
   MPI_Dims_create(nprocs, 2, dims);
   if (dims[0] != dims[1])	{
-    if (my_id == 0) printf("\nThe number of processes must be a square number.\n");
-    MPI_Finalize();
-    return 0;
+    if (my_id == 0) printf("\nThe number of processes must be a square number (use -engine summa otherwise).\n");
+    return;
   }
 
   periods[0] = periods[1] = 1;	/* setting periodicity in each direction for wraparound */
 
-  local_N = N / dims[0];
+  local_N = (opts->N + dims[0] - 1) / dims[0];	/* padded block size, the balanced blocks differ by at most one row/column */
 
-  allocate_memory(&local_A, &local_B, &local_C, &buffer, local_N, MPI_COMM_WORLD);
-  
-  populate_matrices(local_A, local_B, local_C, local_N, MPI_COMM_WORLD);
-  
   /* creating new communicator */ 
   MPI_Cart_create(MPI_COMM_WORLD, 2, dims, periods, 1, &cannon_comm); /* create a new communicator with cartesian topology */
+  MPI_Comm_rank(cannon_comm, &my_id);	/* rank may be reordered in the new communicator */
+
+  allocate_memory(&local_A, &local_B, &local_C, &buffer_A, &buffer_B, local_N);
   
-  /* obtain ranks of neighbouring processes */
-  MPI_Cart_shift(cannon_comm, 0, 1, &left, &right);
-  MPI_Cart_shift(cannon_comm, 1, 1, &up, &down);
+  populate_matrices(local_A, local_B, local_C, local_N, opts, &global_A, &global_B, cannon_comm);
+  initial_A = malloc(local_N * local_N * sizeof(double));	/* the skew and the shifts move the blocks, every run starts from these */
+  initial_B = malloc(local_N * local_N * sizeof(double));
+  memcpy(initial_A, local_A, local_N * local_N * sizeof(double));
+  memcpy(initial_B, local_B, local_N * local_N * sizeof(double));
   
   /* shift cycle of cannon algorithm begins */
-  start_time = MPI_Wtime();
-  for(i = 0; i < dims[0]; i++)	{
-  	matrix_mult(local_A, local_B, local_C, local_N);
-  	if (i == dims[0]-1) break;
-  	
-  	/* communication calls */
-  	MPI_Sendrecv(local_A, local_N*local_N, MPI_DOUBLE, left, 1, buffer, local_N*local_N, MPI_DOUBLE, right, 1, cannon_comm, &status);
-  	temp = buffer;
-  	buffer = local_A;
-  	local_A = temp;
-  	MPI_Sendrecv(local_B, local_N*local_N, MPI_DOUBLE, up, 2, buffer, local_N*local_N, MPI_DOUBLE, down, 2, cannon_comm, &status);
-  	temp = buffer;
-  	buffer = local_B;
-  	local_B = temp;
-  }  	
-  
-  MPI_Barrier(cannon_comm);
-  end_time = MPI_Wtime();
+  while (bench_next(&opts->bench, cannon_comm))	{
+    memcpy(local_A, initial_A, local_N * local_N * sizeof(double));	/* O(local_N^2), negligible next to the local_N^3 products */
+    memcpy(local_B, initial_B, local_N * local_N * sizeof(double));
+    memset(local_C, 0, local_N * local_N * sizeof(double));
+    skew_matrices(local_A, local_B, local_N, 0, cannon_comm);
+    if (opts->overlap)
+      compute_time = cannon_shift_overlapped(&local_A, &local_B, local_C, &buffer_A, &buffer_B, local_N, dims[0], cannon_comm, kernel);
+    else
+      compute_time = cannon_shift_blocking(&local_A, &local_B, local_C, &buffer_A, local_N, dims[0], cannon_comm, kernel);
+  }
+  stats = bench_report(&opts->bench, "matrix_multiplication_canon", opts->overlap ? "cannon_overlap" : "cannon", opts->N, cannon_comm);
+  free(initial_A);
+  free(initial_B);
+
+  /* 2*local_N^3 flops per shift step */
+  report_gflops(compute_time > 0.0 ? 2.0 * local_N * local_N * (double)local_N * dims[0] / compute_time * 1.0e-9 : 0.0, cannon_comm);
   
   /* printing random element of the obtained matrix from each process */
-  /* as the values assigned were 1.0, the obtained matrix-C should have elements equal to N */
+  /* for the "ones" input, the obtained matrix-C should have elements equal to N */
   //printf("\nCheck printing local_C values: C[%d][%d] = %lf from process = %d\n", local_N/2, local_N/2, local_C[(local_N/2 * local_N) + (local_N/2)], my_id);
   
-  if (my_id == 0)	{	// user can turn off/on the comment for printing the obtained global matrix for smaller matrices
-    global_C = malloc(N * N * sizeof(double));
-    MPI_Gather(local_C, local_N*local_N, MPI_DOUBLE, global_C, local_N*local_N, MPI_DOUBLE, 0, cannon_comm);
+  if (opts->file_C != NULL)	/* every process writes its own 2D block of C */
+    write_cannon_block(opts->file_C, local_C, opts->N, local_N, cannon_comm);
+
+  if (opts->N <= 16 || opts->verify)	{	/* the global C is only collected for printing/verification */
+    if (my_id == 0) global_C = malloc((size_t)opts->N * opts->N * sizeof(double));
+    gather_matrix(local_C, global_C, opts->N, local_N, cannon_comm);
+    if (my_id == 0) print_and_verify(global_A, global_B, global_C, opts);
+  }
+
+  free(global_A);
+  free(global_B);
+  free(global_C);
+  
+  if (my_id == 0) printf("\nProgram running time (median) = %lf, processes used = %d, engine = cannon, overlapped shifts = %s\n", stats.median, nprocs, opts->overlap ? "yes" : "no");
+  
+  deallocate_memory(local_A, local_B, local_C, buffer_A, buffer_B);  
+  MPI_Comm_free(&cannon_comm);
+  return;
+}
+
+void run_summa(options_t *opts, micro_kernel_t kernel)	{
+
+  int my_id, nprocs, i, m, n, row_s, col_s;
+  int dims[2], periods[2], coords[2];
+  int remain_dims[2];
+  MPI_Comm grid_comm, row_comm, col_comm;
+
+  double *local_A, *local_B, *local_C;
+  double* global_A = NULL;
+  double* global_B = NULL;
+  double* global_C = NULL;
+  double compute_time = 0.0;
+  bench_stats_t stats;
+
+  MPI_Comm_size(MPI_COMM_WORLD, &nprocs);
+
+  /* any pr x pc grid works for SUMMA */
+  dims[0] = dims[1] = 0;
+  MPI_Dims_create(nprocs, 2, dims);
+  periods[0] = periods[1] = 0;
+  MPI_Cart_create(MPI_COMM_WORLD, 2, dims, periods, 1, &grid_comm);
+  MPI_Comm_rank(grid_comm, &my_id);
+  MPI_Cart_coords(grid_comm, my_id, 2, coords);
+
+  /* row and column sub-communicators for the panel broadcasts */
+  remain_dims[0] = 0; remain_dims[1] = 1;
+  MPI_Cart_sub(grid_comm, remain_dims, &row_comm);
+  remain_dims[0] = 1; remain_dims[1] = 0;
+  MPI_Cart_sub(grid_comm, remain_dims, &col_comm);
+
+  block_range(opts->N, dims[0], coords[0], &row_s, &m);
+  block_range(opts->N, dims[1], coords[1], &col_s, &n);
+  local_A = malloc((m * n + 1) * sizeof(double));
+  local_B = malloc((m * n + 1) * sizeof(double));
+  local_C = calloc(m * n + 1, sizeof(double));
+
+  if (strcmp(opts->input, "ones") == 0)	{	/* every element of C should be equal to N */
+    for(i = 0; i < m*n; i++)	{
+      local_A[i] = 1.0;
+      local_B[i] = 1.0;
+    }
+  }
+  else if (strcmp(opts->input, "file") == 0)	{	/* every process reads its own (ragged) 2D block with MPI-IO */
+    read_matrix_block(opts->file_A, local_A, opts->N, opts->N, row_s, m, col_s, n, grid_comm);
+    read_matrix_block(opts->file_B, local_B, opts->N, opts->N, row_s, m, col_s, n, grid_comm);
+    if (opts->verify) build_global_matrices(opts, &global_A, &global_B, grid_comm);
   }
   else	{
-    MPI_Gather(local_C, local_N*local_N, MPI_DOUBLE, NULL, local_N*local_N, MPI_DOUBLE, 0, cannon_comm);
+    build_global_matrices(opts, &global_A, &global_B, grid_comm);
+    scatter_ragged_blocks(global_A, local_A, opts->N, grid_comm);
+    scatter_ragged_blocks(global_B, local_B, opts->N, grid_comm);
+  }
+
+  while (bench_next(&opts->bench, grid_comm))	{
+    memset(local_C, 0, m * n * sizeof(double));	/* summa accumulates into C */
+    compute_time = summa_multiply(local_A, local_B, local_C, opts->N, opts->nb, grid_comm, row_comm, col_comm, kernel);
+  }
+  stats = bench_report(&opts->bench, "matrix_multiplication_canon", "summa", opts->N, grid_comm);
+
+  report_gflops(compute_time > 0.0 ? 2.0 * m * n * (double)opts->N / compute_time * 1.0e-9 : 0.0, grid_comm);
+
+  if (opts->file_C != NULL)
+    write_matrix_block(opts->file_C, local_C, opts->N, opts->N, row_s, m, col_s, n, grid_comm);
+
+  if (opts->N <= 16 || opts->verify)	{
+    if (my_id == 0) global_C = malloc((size_t)opts->N * opts->N * sizeof(double));
+    gather_ragged_blocks(local_C, global_C, opts->N, grid_comm);
+    if (my_id == 0) print_and_verify(global_A, global_B, global_C, opts);
+  }
+
+  free(global_A);
+  free(global_B);
+  free(global_C);
+
+  if (my_id == 0) printf("\nProgram running time (median) = %lf, processes used = %d (%d x %d grid), engine = summa, panel width = %d\n", stats.median, nprocs, dims[0], dims[1], opts->nb);
+
+  free(local_A);
+  free(local_B);
+  free(local_C);
+  MPI_Comm_free(&row_comm);
+  MPI_Comm_free(&col_comm);
+  MPI_Comm_free(&grid_comm);
+  return;
+}
+
+/* 2.5D (communication-avoiding) cannon algorithm on a q x q x c grid: the A/B blocks of layer 0 are replicated to the c */
+/* layers, layer l runs its share of the q shift steps starting at step offset l, and C is reduced across the layers */
+/* (replication, shifts and reduction are timed by the benchmark harness, variant "2.5d-c<c>") */
+/* returns the median time on the root, or a negative value if c is not valid for the number of processes */
+double run_25d(options_t *opts, micro_kernel_t kernel, int c, int print)	{
+
+  int my_id, nprocs, q, local_N, step_s, nsteps;
+  int dims[3], periods[3], coords[3], remain_dims[3];
+  MPI_Comm grid_comm, layer_comm, depth_comm;
+
+  double *local_A, *local_B, *local_C, *buffer_A, *buffer_B, *initial_A = NULL, *initial_B = NULL;
+  double* global_A = NULL;
+  double* global_B = NULL;
+  double* global_C = NULL;
+  double t[4] = {0.0, 0.0, 0.0, 0.0}, compute_time = 0.0, max_compute_time = 0.0;
+  char variant[32];
+  bench_stats_t stats;
+
+  MPI_Comm_size(MPI_COMM_WORLD, &nprocs);
+  MPI_Comm_rank(MPI_COMM_WORLD, &my_id);
+
+  q = (int)(sqrt((double)nprocs / c) + 0.5);
+  if (c < 1 || nprocs % c != 0 || q * q * c != nprocs || c > q)	{
+    if (my_id == 0 && print) printf("\nThe 2.5D engine needs p/c to be a square number q^2 with c <= q.\n");
+    return -1.0;
   }
+  local_N = (opts->N + q - 1) / q;	/* padded block size */
 
-  MPI_Barrier(cannon_comm);
+  /* 3D communicator built on top of the 2D cannon grid: periodic within a layer, not along the depth */
+  dims[0] = dims[1] = q;
+  dims[2] = c;
+  periods[0] = periods[1] = 1;
+  periods[2] = 0;
+  MPI_Cart_create(MPI_COMM_WORLD, 3, dims, periods, 1, &grid_comm);
+  MPI_Comm_rank(grid_comm, &my_id);
+  MPI_Cart_coords(grid_comm, my_id, 3, coords);
 
+  remain_dims[0] = remain_dims[1] = 1; remain_dims[2] = 0;
+  MPI_Cart_sub(grid_comm, remain_dims, &layer_comm);	/* q x q cannon grid of this layer */
+  remain_dims[0] = remain_dims[1] = 0; remain_dims[2] = 1;
+  MPI_Cart_sub(grid_comm, remain_dims, &depth_comm);	/* the c copies of this block, rank = layer index */
+
+  allocate_memory(&local_A, &local_B, &local_C, &buffer_A, &buffer_B, local_N);
+  if (coords[2] == 0)	{
+    populate_matrices(local_A, local_B, local_C, local_N, opts, &global_A, &global_B, layer_comm);
+    initial_A = malloc(local_N * local_N * sizeof(double));	/* the skew and the shifts move the blocks, every run starts from these */
+    initial_B = malloc(local_N * local_N * sizeof(double));
+    memcpy(initial_A, local_A, local_N * local_N * sizeof(double));
+    memcpy(initial_B, local_B, local_N * local_N * sizeof(double));
+  }
+  block_range(q, c, coords[2], &step_s, &nsteps);	/* shortened cannon cycle: layer l performs q/c of the q steps */
+
+  while (bench_next(&opts->bench, grid_comm))	{
+    if (coords[2] == 0)	{
+      memcpy(local_A, initial_A, local_N * local_N * sizeof(double));
+      memcpy(local_B, initial_B, local_N * local_N * sizeof(double));
+    }
+    memset(local_C, 0, local_N * local_N * sizeof(double));
+    t[0] = MPI_Wtime();
+
+    /* replicate A and B across the layers */
+    MPI_Bcast(local_A, local_N*local_N, MPI_DOUBLE, 0, depth_comm);
+    MPI_Bcast(local_B, local_N*local_N, MPI_DOUBLE, 0, depth_comm);
+    t[1] = MPI_Wtime();
+
+    skew_matrices(local_A, local_B, local_N, step_s, layer_comm);
+    if (opts->overlap)
+      compute_time = cannon_shift_overlapped(&local_A, &local_B, local_C, &buffer_A, &buffer_B, local_N, nsteps, layer_comm, kernel);
+    else
+      compute_time = cannon_shift_blocking(&local_A, &local_B, local_C, &buffer_A, local_N, nsteps, layer_comm, kernel);
+    t[2] = MPI_Wtime();
+
+    /* sum the partial products of the layers onto layer 0 */
+    if (coords[2] == 0)	MPI_Reduce(MPI_IN_PLACE, local_C, local_N*local_N, MPI_DOUBLE, MPI_SUM, 0, depth_comm);
+    else			MPI_Reduce(local_C, NULL, local_N*local_N, MPI_DOUBLE, MPI_SUM, 0, depth_comm);
+    MPI_Barrier(grid_comm);
+    t[3] = MPI_Wtime();
+  }
+  snprintf(variant, sizeof(variant), "2.5d-c%d", c);
+  stats = bench_report(&opts->bench, "matrix_multiplication_canon", variant, opts->N, grid_comm);
+  free(initial_A);
+  free(initial_B);
+
+  if (print) report_gflops(compute_time > 0.0 ? 2.0 * local_N * local_N * (double)local_N * nsteps / compute_time * 1.0e-9 : 0.0, grid_comm);
+  MPI_Reduce(&compute_time, &max_compute_time, 1, MPI_DOUBLE, MPI_MAX, 0, grid_comm);
+
+  if (coords[2] == 0 && opts->file_C != NULL)
+    write_cannon_block(opts->file_C, local_C, opts->N, local_N, layer_comm);
+
+  if (coords[2] == 0 && ((print && opts->N <= 16) || opts->verify))	{
+    if (my_id == 0) global_C = malloc((size_t)opts->N * opts->N * sizeof(double));
+    gather_matrix(local_C, global_C, opts->N, local_N, layer_comm);
+    if (my_id == 0) print_and_verify(global_A, global_B, global_C, opts);
+  }
+
+  /* per-process words moved: replication 2, skew 2, shifts 2*(nsteps-1), reduction 1 (in units of local_N^2); phases of the last trial */
   if (my_id == 0)	{
-    printf("\n---------Printing global matrix-C---------\n");	
-    for(i = 0; i < N; i++)	{
-      for(j = 0; j < N; j++)	{
-	printf("%lf ", global_C[i*N+j]);
-      }
-      printf("\n");
+    printf("c = %d, grid = %d x %d x %d, block = %d, words/process ~ %.3e, memory/process = %.3e MB, replicate = %lf, cannon = %lf (compute %lf), reduce = %lf, total = %lf, median total = %lf\n",
+	   c, q, q, c, local_N, (5.0 + 2.0 * (nsteps - 1)) * local_N * (double)local_N, 5.0 * local_N * (double)local_N * sizeof(double) / 1.0e6,
+	   t[1]-t[0], t[2]-t[1], max_compute_time, t[3]-t[2], t[3]-t[0], stats.median);
+  }
+
+  free(global_A);
+  free(global_B);
+  free(global_C);
+  deallocate_memory(local_A, local_B, local_C, buffer_A, buffer_B);
+  MPI_Comm_free(&layer_comm);
+  MPI_Comm_free(&depth_comm);
+  MPI_Comm_free(&grid_comm);
+  return stats.median;
+}
+
+/* benchmark of the 2.5D engine over every valid replication factor, trading memory for bandwidth: the factors are */
+/* compared by their median time over the trials of the benchmark harness (decided on the root) */
+void sweep_25d(options_t *opts, micro_kernel_t kernel)	{
+
+  int my_id, nprocs, c;
+  double time, best_time = 0.0;
+  int best_c = 0;
+
+  MPI_Comm_size(MPI_COMM_WORLD, &nprocs);
+  MPI_Comm_rank(MPI_COMM_WORLD, &my_id);
+  if (my_id == 0) printf("\n---------2.5D sweep over the replication factor c, N = %d, processes = %d---------\n", opts->N, nprocs);
+
+  for(c = 1; c <= nprocs; c++)	{
+    time = run_25d(opts, kernel, c, 0);
+    if (time < 0.0) continue;
+    if (best_c == 0 || time < best_time)	{
+      best_c = c;
+      best_time = time;
     }
+  }
 
-    free(global_C);
-  }	
-  
-  if (my_id == 0) printf("\nProgram running time = %lf, processes used = %d\n", end_time-start_time, nprocs);
-  
-  deallocate_memory(local_A, local_B, local_C, buffer, MPI_COMM_WORLD);  
-  
+  if (my_id == 0)	{
+    if (best_c == 0) printf("No valid replication factor for %d processes and N = %d.\n", nprocs, opts->N);
+    else printf("\nFastest replication factor c = %d, median time = %lf\n", best_c, best_time);
+  }
+  return;
+}
+
+int main(int argc, char *argv[])	{
+
+  int my_id, provided;
+  options_t opts = {.engine = "cannon", .c = 1, .sweep = 0, .N = 16, .nb = KC, .kernel_name = "auto", .overlap = 0,
+		    .input = "ones", .file_A = "A.mat", .file_B = "B.mat", .file_C = NULL, .verify = 0};
+  int rows_B, cols_B;
+  const char *chosen_kernel;
+  micro_kernel_t kernel;
+  double kernel_error;
+
+  MPI_Init_thread(&argc, &argv, MPI_THREAD_FUNNELED, &provided);	/* only the master thread makes MPI calls */
+  MPI_Comm_rank(MPI_COMM_WORLD, &my_id);
+  if (my_id == 0 && provided < MPI_THREAD_FUNNELED) printf("\nWarning: the MPI library does not provide MPI_THREAD_FUNNELED.\n");
+
+  parse_arguments(argc, argv, &opts);
+  bench_init(&opts.bench, argc, argv, 1, 3);	/* -warmup, -trials, -bench, -bench-out */
+  kernel = select_micro_kernel(opts.kernel_name, &chosen_kernel);
+
+  if (strcmp(opts.input, "file") == 0)	{	/* the size of the global matrices is taken from the file headers */
+    if (!read_matrix_header(opts.file_A, &opts.N, &rows_B, MPI_COMM_WORLD) || opts.N != rows_B ||
+	!read_matrix_header(opts.file_B, &rows_B, &cols_B, MPI_COMM_WORLD) || rows_B != opts.N || cols_B != opts.N)	{
+      if (my_id == 0) printf("\nCould not read square matrices of the same size from '%s' and '%s'. Exiting!!\n", opts.file_A, opts.file_B);
+      MPI_Finalize();
+      return 0;
+    }
+  }
+
+  /* verify the blocked kernel against the naive loop before using it */
+  kernel_error = check_matrix_mult(opts.N < 200 ? opts.N : 200, kernel);
+  if (my_id == 0) printf("\nLocal GEMM kernel = %s, max relative error against naive kernel = %e, threads per process = %d\n", chosen_kernel, kernel_error, omp_get_max_threads());
+
+  if (strcmp(opts.engine, "summa") == 0)
+    run_summa(&opts, kernel);
+  else if (strcmp(opts.engine, "2.5d") == 0 && opts.sweep)
+    sweep_25d(&opts, kernel);
+  else if (strcmp(opts.engine, "2.5d") == 0)
+    run_25d(&opts, kernel, opts.c, 1);
+  else
+    run_cannon(&opts, kernel);
+
+  bench_free(&opts.bench);
+  gemm_free_buffers();
   MPI_Finalize();  
   return 0;
 }
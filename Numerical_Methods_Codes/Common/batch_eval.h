@@ -0,0 +1,133 @@
+// Batched, vectorized evaluation of integrands shared by the quadrature programs
+// An integrand is given as a batch function f(x[], fx[], count) whose loop the compiler vectorizes (#pragma omp simd). The
+// sums of the quadrature rules run over strided points x0 + j*step, generated and evaluated EVAL_BATCH at a time, so there is no
+// per-point call and no branch in the inner loops. simd_sin is a branch-free sine written in plain arithmetic (no libm call),
+// so that it vectorizes inside those loops without -ffast-math.
+#ifndef BATCH_EVAL_H
+#define BATCH_EVAL_H
+
+#include <math.h>
+#include "exact_sum.h"
+#include "block_decomposition.h"
+
+#define EVAL_BATCH 256		/* points per batch, the x and f(x) arrays stay in L1 cache */
+
+typedef void (*batch_func_t)(const double *x, double *fx, int count);
+
+/* sine with a relative error of a few ulp for |x| < 1e6: x = k*pi + r with |r| <= pi/2 (Cody-Waite: pi_hi and pi_mid have */
+/* 33 significant bits, so k*pi_hi and k*pi_mid are exact for |k| < 2^20, with or without FMA contraction), */
+/* Taylor polynomial of sin(r) up to r^21 (truncation error < 1e-17 on [-pi/2, pi/2]), sign (-1)^k */
+static inline double simd_sin(double x)	{
+  const double inv_pi = 0.318309886183790671538;
+  const double pi_hi = 3.1415926534682512, pi_mid = 1.2154201012607932e-10, pi_lo = 4.044532497591901e-21;
+  double k = floor(x * inv_pi + 0.5);
+  double r = ((x - k * pi_hi) - k * pi_mid) - k * pi_lo, r2 = r * r, p;
+
+  p = -1.0/121645100408832000.0 + r2 * (1.0/51090942171709440000.0);
+  p = 1.0/355687428096000.0 + r2 * p;
+  p = -1.0/1307674368000.0 + r2 * p;
+  p = 1.0/6227020800.0 + r2 * p;
+  p = -1.0/39916800.0 + r2 * p;
+  p = 1.0/362880.0 + r2 * p;
+  p = -1.0/5040.0 + r2 * p;
+  p = 1.0/120.0 + r2 * p;
+  p = -1.0/6.0 + r2 * p;
+  p = r + r * r2 * p;
+  return (1.0 - 2.0 * (k - 2.0 * floor(0.5 * k))) * p;	/* (-1)^k without an integer conversion */
+}
+
+/* sum of f(x0 + j*step) for j = 0..count-1, batches are shared among the OpenMP threads */
+static inline double batch_strided_sum(batch_func_t f, double x0, double step, long count)	{
+  double sum = 0.0;
+  long s;
+
+#pragma omp parallel for reduction(+:sum) schedule(static)
+  for(s = 0; s < count; s += EVAL_BATCH)	{
+    double x[EVAL_BATCH], fx[EVAL_BATCH], batch_sum = 0.0;
+    int i, n = (count - s < EVAL_BATCH) ? (int)(count - s) : EVAL_BATCH;
+
+#pragma omp simd
+    for(i = 0; i < n; i++)
+      x[i] = x0 + (s + i) * step;
+    f(x, fx, n);
+#pragma omp simd reduction(+:batch_sum)
+    for(i = 0; i < n; i++)
+      batch_sum += fx[i];
+    sum += batch_sum;
+  }
+  return sum;
+}
+
+/* compensated (Neumaier) sum of fx[0..n-1] in SUM_LANES interleaved lanes, so that it vectorizes: returns the sum, and the */
+/* accumulated rounding errors in *comp. The order of the operations is fixed by n alone. */
+#define SUM_LANES 8
+
+static inline double batch_neumaier_sum(const double *fx, int n, double *comp)	{
+  double s[SUM_LANES] = {0.0}, c[SUM_LANES] = {0.0}, sum = 0.0, err = 0.0, t;
+  int i, l;
+
+  for(i = 0; i < n; i += SUM_LANES)	{
+    int m = (n - i < SUM_LANES) ? n - i : SUM_LANES;
+#pragma omp simd private(t)
+    for(l = 0; l < m; l++)	{
+      t = s[l] + fx[i+l];
+      c[l] += (fabs(s[l]) >= fabs(fx[i+l])) ? (s[l] - t) + fx[i+l] : (fx[i+l] - t) + s[l];
+      s[l] = t;
+    }
+  }
+  for(l = 0; l < SUM_LANES; l++)	{
+    t = sum + s[l];
+    err += (fabs(sum) >= fabs(s[l])) ? (sum - t) + s[l] : (s[l] - t) + sum;
+    err += c[l];
+    sum = t;
+  }
+  *comp = err;
+  return sum;
+}
+
+/* reproducible counterpart of batch_strided_sum: adds weight * f(x0 + j*step), j = first..first+count-1, to the exact */
+/* accumulator acc. The points are cut into batches on a fixed grid of the global index (j = 0..EVAL_BATCH-1, ...), so first */
+/* must be a multiple of EVAL_BATCH (see batch_block_range). Every batch is then the same set of points, with the same bits, */
+/* whichever process and thread sums it; its compensated sum (sum and error term) goes into acc without rounding. With two */
+/* deposits per batch the exact accumulation costs next to nothing. The weight must be a power of two (exact product). */
+static inline void batch_strided_deposit(batch_func_t f, double x0, double step, long first, long count, double weight, exact_sum_t *acc)	{
+  long s;
+
+#pragma omp parallel
+  {
+    exact_sum_t thread_acc;
+
+    exact_sum_init(&thread_acc);
+#pragma omp for schedule(static)
+    for(s = 0; s < count; s += EVAL_BATCH)	{
+      double x[EVAL_BATCH], fx[EVAL_BATCH], sum, comp;
+      int i, n = (count - s < EVAL_BATCH) ? (int)(count - s) : EVAL_BATCH;
+
+#pragma omp simd
+      for(i = 0; i < n; i++)
+	x[i] = x0 + (double)(first + s + i) * step;
+      f(x, fx, n);
+      sum = batch_neumaier_sum(fx, n, &comp);
+      exact_sum_add(&thread_acc, weight * sum);
+      exact_sum_add(&thread_acc, weight * comp);
+    }
+#pragma omp critical
+    exact_sum_merge(acc, &thread_acc);
+  }
+  return;
+}
+
+/* the points of 0..count-1 summed by process my_id in batch_strided_deposit: whole batches of the grid, balanced over the */
+/* processes (block sizes differ by at most one batch) */
+static inline void batch_block_range(long count, int nprocs, int my_id, long *first, long *local_count)	{
+  int batch_start, local_batches;
+
+  block_range((int)((count + EVAL_BATCH - 1) / EVAL_BATCH), nprocs, my_id, &batch_start, &local_batches);
+  *first = (long)batch_start * EVAL_BATCH;
+  *local_count = (long)local_batches * EVAL_BATCH;
+  if (*first + *local_count > count) *local_count = count - *first;
+  if (*local_count < 0) *local_count = 0;
+  return;
+}
+
+#endif
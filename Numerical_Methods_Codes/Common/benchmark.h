@@ -0,0 +1,137 @@
+// Benchmark harness shared by the MPI programs
+// The timed region of a program is run a few untimed warm-up times and then repeated for a number of trials. Every trial is
+// timed on every process; the trial time is the time of the slowest process (MPI_Reduce with MPI_MAX), and the fastest process
+// (MPI_MIN) is kept to show the load imbalance. The root prints min/median/max over the trials and can append the record to a
+// CSV or JSON-lines file, which is what Benchmark/scaling_sweep.sh collects.
+// Command-line options (ignored by the programs' own parsers): -warmup <runs> -trials <runs> -bench <text|csv|json> -bench-out <file>
+#ifndef BENCHMARK_H
+#define BENCHMARK_H
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <mpi.h>
+#ifdef _OPENMP
+#include <omp.h>
+#endif
+
+typedef struct	{
+  int warmup;			/* untimed runs before the trials */
+  int trials;			/* timed runs */
+  const char *format;		/* text (printed only), csv or json (record appended to out) */
+  const char *out;		/* file the csv/json records are appended to, NULL for stdout */
+  int run;			/* runs started so far, warm-up runs included */
+  double t0;			/* start of the current run */
+  double *times;		/* time of every trial on this process */
+} bench_t;
+
+typedef struct	{		/* summary over the trials, valid on the root only */
+  double min, median, max;	/* trial time = time of the slowest process */
+  double fastest;		/* median trial time of the fastest process */
+} bench_stats_t;
+
+/* reads the harness options, the defaults are given by the program */
+static inline void bench_init(bench_t *bench, int argc, char *argv[], int warmup, int trials)	{
+
+  bench->warmup = warmup;
+  bench->trials = trials;
+  bench->format = "text";
+  bench->out = NULL;
+  for(int i = 1; i < argc-1; i++)	{
+    if (strcmp(argv[i], "-warmup") == 0)		bench->warmup = atoi(argv[++i]);
+    else if (strcmp(argv[i], "-trials") == 0)		bench->trials = atoi(argv[++i]);
+    else if (strcmp(argv[i], "-bench") == 0)		bench->format = argv[++i];
+    else if (strcmp(argv[i], "-bench-out") == 0)	bench->out = argv[++i];
+  }
+  if (bench->warmup < 0) bench->warmup = 0;
+  if (bench->trials < 1) bench->trials = 1;
+  bench->run = 0;
+  bench->t0 = 0.0;
+  bench->times = malloc(bench->trials * sizeof(double));
+  return;
+}
+
+/* loop condition around the timed region: while (bench_next(&bench, comm)) { ... } */
+/* stops the clock of the previous run, synchronizes the processes and starts the next run, returns 0 after the last trial */
+/* (and rewinds, so the same harness can time another region once the trials have been reported) */
+static inline int bench_next(bench_t *bench, MPI_Comm comm)	{
+
+  double t = MPI_Wtime();
+
+  if (bench->run > bench->warmup) bench->times[bench->run - bench->warmup - 1] = t - bench->t0;
+  if (bench->run == bench->warmup + bench->trials)	{
+    bench->run = 0;
+    return 0;
+  }
+  MPI_Barrier(comm);
+  bench->run++;
+  bench->t0 = MPI_Wtime();
+  return 1;
+}
+
+static inline int bench_compare(const void *a, const void *b)	{
+  double x = *(const double *)a, y = *(const double *)b;
+  return (x > y) - (x < y);
+}
+
+/* collective: summary of the trials over the processes, printed and recorded by the root */
+/* size is the problem size the program was run with (matrix order, number of divisions, ...) */
+static inline bench_stats_t bench_report(bench_t *bench, const char *program, const char *variant, long size, MPI_Comm comm)	{
+
+  int my_id, nprocs, nthreads = 1, k = bench->trials;
+  double *slowest = NULL, *fastest = NULL;
+  bench_stats_t stats = {0.0, 0.0, 0.0, 0.0};
+  FILE *fptr;
+
+  MPI_Comm_rank(comm, &my_id);
+  MPI_Comm_size(comm, &nprocs);
+#ifdef _OPENMP
+  nthreads = omp_get_max_threads();
+#endif
+  if (my_id == 0)	{
+    slowest = malloc(k * sizeof(double));
+    fastest = malloc(k * sizeof(double));
+  }
+  MPI_Reduce(bench->times, slowest, k, MPI_DOUBLE, MPI_MAX, 0, comm);
+  MPI_Reduce(bench->times, fastest, k, MPI_DOUBLE, MPI_MIN, 0, comm);
+
+  if (my_id == 0)	{
+    qsort(slowest, k, sizeof(double), bench_compare);
+    qsort(fastest, k, sizeof(double), bench_compare);
+    stats.min = slowest[0];
+    stats.max = slowest[k-1];
+    stats.median = (k % 2) ? slowest[k/2] : 0.5 * (slowest[k/2-1] + slowest[k/2]);
+    stats.fastest = (k % 2) ? fastest[k/2] : 0.5 * (fastest[k/2-1] + fastest[k/2]);
+    printf("Benchmark %s (%s, size = %ld): min = %lf, median = %lf, max = %lf over %d trials (%d warm-up), fastest process median = %lf\n",
+	   program, variant, size, stats.min, stats.median, stats.max, k, bench->warmup, stats.fastest);
+
+    if (strcmp(bench->format, "csv") == 0 || strcmp(bench->format, "json") == 0)	{
+      fptr = bench->out ? fopen(bench->out, "a") : stdout;
+      if (fptr == NULL)	{
+	printf("Could not open '%s' for the benchmark record.\n", bench->out);
+      }
+      else if (strcmp(bench->format, "csv") == 0)	{
+	if (fptr == stdout || (fseek(fptr, 0, SEEK_END) == 0 && ftell(fptr) == 0)) fprintf(fptr, "program,variant,size,processes,threads,warmup,trials,min,median,max,fastest_median\n");
+	fprintf(fptr, "%s,%s,%ld,%d,%d,%d,%d,%e,%e,%e,%e\n", program, variant, size, nprocs, nthreads, bench->warmup, k,
+		stats.min, stats.median, stats.max, stats.fastest);
+      }
+      else	{
+	fprintf(fptr, "{\"program\": \"%s\", \"variant\": \"%s\", \"size\": %ld, \"processes\": %d, \"threads\": %d, \"warmup\": %d, \"trials\": %d, "
+		"\"min\": %e, \"median\": %e, \"max\": %e, \"fastest_median\": %e}\n", program, variant, size, nprocs, nthreads, bench->warmup, k,
+		stats.min, stats.median, stats.max, stats.fastest);
+      }
+      if (fptr != NULL && fptr != stdout) fclose(fptr);
+    }
+    free(slowest);
+    free(fastest);
+  }
+  return stats;
+}
+
+static inline void bench_free(bench_t *bench)	{
+  free(bench->times);
+  bench->times = NULL;
+  return;
+}
+
+#endif
@@ -0,0 +1,40 @@
+// Balanced block decomposition shared by the MPI programs
+// N items (rows, columns, points, sub-intervals) are split over p processes so that block sizes differ by at most one:
+// the first N%p blocks get one extra item. Any N works with any number of processes.
+#ifndef BLOCK_DECOMPOSITION_H
+#define BLOCK_DECOMPOSITION_H
+
+/* start index and size of block i */
+static inline void block_range(int N, int p, int i, int *start_p, int *size_p)	{
+
+  int q = N / p, r = N % p;
+
+  *size_p = q + (i < r ? 1 : 0);
+  *start_p = i * q + (i < r ? i : r);
+  return;
+}
+
+/* index of the block owning item k */
+static inline int block_owner(int N, int p, int k)	{
+
+  int q = N / p, r = N % p;
+
+  if (k < r * (q + 1)) return k / (q + 1);
+  return r + (k - r * (q + 1)) / q;
+}
+
+/* counts and displacements of all p blocks for the v-collectives (MPI_Scatterv, MPI_Gatherv, MPI_Allgatherv) */
+/* unit is the number of elements per item, e.g. the row length when rows are distributed */
+static inline void block_counts(int N, int p, int unit, int *counts, int *displs)	{
+
+  int start, size;
+
+  for(int i = 0; i < p; i++)	{
+    block_range(N, p, i, &start, &size);
+    counts[i] = size * unit;
+    displs[i] = start * unit;
+  }
+  return;
+}
+
+#endif
@@ -0,0 +1,130 @@
+// Exact, reproducible summation of doubles shared by the quadrature programs
+// Every double is a 53-bit integer times a power of two, so it can be added without any rounding into a long fixed-point
+// number covering the whole double range (2^-1074 .. 2^1024), stored as 32-bit digits in 64-bit integers (a superaccumulator).
+// The sum is exact, hence independent of the order of the additions: splitting the terms over any number of processes and
+// threads, and merging the partial accumulators with the MPI_Op below, gives the same bits. The result is rounded to a double
+// only once, at the end. A deposit costs a few integer operations and the carries are propagated only every EXACT_FLUSH deposits.
+#ifndef EXACT_SUM_H
+#define EXACT_SUM_H
+
+#include <stdint.h>
+#include <string.h>
+#include <stddef.h>
+#include <math.h>
+#include <mpi.h>
+
+#define EXACT_DIGITS 68			/* 32-bit digits: 2098 bits of the double range, the top digits take the carries */
+#define EXACT_FLUSH (1L << 29)		/* deposits between carry propagations, a digit grows by < 2^33 per deposit */
+
+typedef struct	{
+  int64_t digit[EXACT_DIGITS];	/* value = sum of digit[k] * 2^(32k - 1074), digits in [0, 2^32) after exact_sum_normalize */
+  double nonfinite;		/* inf and NaN terms, summed as doubles */
+  long pending;			/* deposits since the last carry propagation, local only */
+} exact_sum_t;
+
+static inline void exact_sum_init(exact_sum_t *acc)	{
+  memset(acc, 0, sizeof(exact_sum_t));
+  return;
+}
+
+/* carry propagation, brings every digit but the top (signed) one into [0, 2^32): the representation is then unique */
+static inline void exact_sum_normalize(exact_sum_t *acc)	{
+  int64_t carry = 0;
+
+  for(int k = 0; k < EXACT_DIGITS-1; k++)	{
+    acc->digit[k] += carry;
+    carry = acc->digit[k] >> 32;		/* arithmetic shift: floor division by 2^32 */
+    acc->digit[k] -= carry * ((int64_t)1 << 32);
+  }
+  acc->digit[EXACT_DIGITS-1] += carry;
+  acc->pending = 0;
+  return;
+}
+
+static inline void exact_sum_add(exact_sum_t *acc, double x)	{
+  uint64_t bits, m, lo, hi;
+  int64_t neg;
+  int e, k, sh;
+
+  memcpy(&bits, &x, sizeof(bits));
+  e = (int)((bits >> 52) & 0x7ff);
+  if (e == 0x7ff)	{
+    acc->nonfinite += x;
+    return;
+  }
+  m = bits & 0xfffffffffffffULL;
+  if (e == 0) e = 1;				/* subnormal: no implicit bit */
+  else m |= 1ULL << 52;
+  k = (e - 1) >> 5;				/* x = m * 2^(e-1075), i.e. m starts at bit e-1 of the accumulator */
+  sh = (e - 1) & 31;
+  lo = (m & 0xffffffffULL) << sh;		/* < 2^63 */
+  hi = (m >> 32) << sh;				/* < 2^52 */
+  neg = -(int64_t)(bits >> 63);			/* 0 or -1: (d ^ neg) - neg is d or -d, without a branch */
+  acc->digit[k] += ((int64_t)(lo & 0xffffffffULL) ^ neg) - neg;
+  acc->digit[k+1] += ((int64_t)((lo >> 32) + (hi & 0xffffffffULL)) ^ neg) - neg;
+  acc->digit[k+2] += ((int64_t)(hi >> 32) ^ neg) - neg;
+  if (++acc->pending == EXACT_FLUSH) exact_sum_normalize(acc);
+  return;
+}
+
+/* acc += other, both exact */
+static inline void exact_sum_merge(exact_sum_t *acc, const exact_sum_t *other)	{
+  exact_sum_normalize(acc);
+  for(int k = 0; k < EXACT_DIGITS; k++)
+    acc->digit[k] += other->digit[k];
+  acc->nonfinite += other->nonfinite;
+  exact_sum_normalize(acc);
+  return;
+}
+
+/* the sum rounded to a double, computed from the unique normalized digits, so equal sums give equal bits */
+static inline double exact_sum_value(exact_sum_t *acc)	{
+  exact_sum_t t;
+  double sign = 1.0, value = 0.0;
+
+  exact_sum_normalize(acc);
+  if (acc->nonfinite != 0.0 || isnan(acc->nonfinite)) return acc->nonfinite;
+  t = *acc;
+  if (t.digit[EXACT_DIGITS-1] < 0)	{	/* negative sum: magnitude in the digits */
+    for(int k = 0; k < EXACT_DIGITS; k++)
+      t.digit[k] = -t.digit[k];
+    exact_sum_normalize(&t);
+    sign = -1.0;
+  }
+  for(int k = EXACT_DIGITS-1; k >= 0; k--)	/* most significant first, the error stays within an ulp or so */
+    if (t.digit[k] != 0) value += ldexp((double)t.digit[k], 32*k - 1074);
+  return sign * value;
+}
+
+/* user-defined MPI_Op: inout[i] += in[i] for accumulators sent with the datatype of exact_sum_reduce */
+static inline void exact_sum_op(void *in, void *inout, int *len, MPI_Datatype *type)	{
+  exact_sum_t *a = (exact_sum_t *)in, *b = (exact_sum_t *)inout;
+
+  (void)type;
+  for(int i = 0; i < *len; i++)
+    exact_sum_merge(&b[i], &a[i]);
+  return;
+}
+
+/* collective: the exact sum of the accumulators of all processes, rounded once, on the root */
+static inline double exact_sum_reduce(exact_sum_t *acc, int root, MPI_Comm comm)	{
+  int block_lengths[3] = {EXACT_DIGITS, 1, 1};
+  MPI_Aint displacements[3] = {offsetof(exact_sum_t, digit), offsetof(exact_sum_t, nonfinite), offsetof(exact_sum_t, pending)};
+  MPI_Datatype types[3] = {MPI_INT64_T, MPI_DOUBLE, MPI_LONG}, acc_type;
+  MPI_Op op;
+  exact_sum_t total;
+
+  MPI_Type_create_struct(3, block_lengths, displacements, types, &acc_type);	/* whole struct: the MPI_Op updates every member */
+  MPI_Type_commit(&acc_type);
+  MPI_Op_create(exact_sum_op, 1, &op);		/* exact addition is commutative */
+
+  exact_sum_normalize(acc);
+  exact_sum_init(&total);
+  MPI_Reduce(acc, &total, 1, acc_type, op, root, comm);
+
+  MPI_Op_free(&op);
+  MPI_Type_free(&acc_type);
+  return exact_sum_value(&total);
+}
+
+#endif
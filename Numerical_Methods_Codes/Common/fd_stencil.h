@@ -0,0 +1,318 @@
+// Finite-difference stencils of configurable order for the derivative programs
+// First and second derivatives on a uniform 1-D grid of nx+1 points (boundaries included), block-distributed over the
+// processes, to order 2, 4, 6 or 8:
+//  - explicit: central stencil of radius order/2 at the interior points,
+//  - compact (Pade): alpha (y_{i-1} + y_{i+1}) + y_i = central stencil of radius order/2 - 1 (tridiagonal system).
+// No coefficient is tabulated: the explicit weights come from Fornberg's algorithm for arbitrary nodes, the compact ones from
+// matching the Taylor expansions (alpha = 1/4, 1/3, 3/8 for the first derivative, as in Lele 1992). The points within the
+// radius of a boundary get one-sided explicit closures of the same order (order+1 points for the first derivative, order+2
+// for the second), also from Fornberg's algorithm. The ghost layer exchanged with each neighbour is the stencil radius.
+// The tridiagonal system of the compact schemes spans the processes: each process solves its block with the couplings to its
+// neighbours as unknowns, and the 2 x nprocs interface values are solved on the root (partition method).
+#ifndef FD_STENCIL_H
+#define FD_STENCIL_H
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <mpi.h>
+
+#define FD_MAX_ORDER 8
+#define FD_MAX_RADIUS (FD_MAX_ORDER / 2)
+#define FD_MAX_POINTS (FD_MAX_ORDER + 2)		/* one-sided second derivative closures */
+
+typedef struct	{
+  int deriv;					/* 1 or 2 */
+  int order;					/* 2, 4, 6 or 8 */
+  int compact;					/* 0: explicit, 1: compact (Pade) */
+  int radius;					/* ghost points on each side, also the closure rows at each boundary */
+  int width;					/* points of a one-sided closure */
+  double alpha;					/* compact: coupling of the neighbouring derivatives, 0 for explicit */
+  double interior[2*FD_MAX_RADIUS+1];		/* weights of u_{i-radius} .. u_{i+radius}, divided by dx^deriv */
+  double left[FD_MAX_RADIUS][FD_MAX_POINTS];	/* row g < radius: weights of u_0 .. u_{width-1} */
+  double right[FD_MAX_RADIUS][FD_MAX_POINTS];	/* row nx-k, k < radius: weights of u_{nx-width+1} .. u_nx */
+} fd_stencil_t;
+
+/* Fornberg's algorithm: weights w[0..n-1] of the derivative of order m at z from the values at the nodes x[0..n-1] */
+static inline void fd_weights(int m, double z, const double *x, int n, double *w)	{
+  double c[FD_MAX_POINTS][3] = {{0.0}}, c1 = 1.0, c2, c3, c4 = x[0] - z, c5;
+  int i, j, k, mn;
+
+  c[0][0] = 1.0;
+  for(i = 1; i < n; i++)	{
+    mn = (i < m) ? i : m;
+    c2 = 1.0;
+    c5 = c4;
+    c4 = x[i] - z;
+    for(j = 0; j < i; j++)	{
+      c3 = x[i] - x[j];
+      c2 *= c3;
+      if (j == i-1)	{
+        for(k = mn; k > 0; k--)
+          c[i][k] = c1 * (k * c[i-1][k-1] - c5 * c[i-1][k]) / c2;
+        c[i][0] = -c1 * c5 * c[i-1][0] / c2;
+      }
+      for(k = mn; k > 0; k--)
+        c[j][k] = (c4 * c[j][k] - k * c[j][k-1]) / c3;
+      c[j][0] = c4 * c[j][0] / c3;
+    }
+    c1 = c2;
+  }
+  for(i = 0; i < n; i++)
+    w[i] = c[i][m];
+  return;
+}
+
+/* compact interior of radius r: alpha and the weights c_1..c_r of (u_{i+k} - u_{i-k}) (first derivative) or */
+/* (u_{i+k} - 2u_i + u_{i-k}) (second), exact for the monomials up to degree 2r+2 (2r+3 for the second derivative) */
+static inline void fd_compact_coefficients(int deriv, int r, double *alpha, double *coef)	{
+  double A[FD_MAX_RADIUS][FD_MAX_RADIUS], b[FD_MAX_RADIUS], t;
+  int n = r + 1, i, j, k, p, m;
+
+  for(j = 0; j < n; j++)	{		/* u = x^m at x_i = 0, h = 1 */
+    m = 2 * j + deriv;
+    A[j][0] = (deriv == 1) ? 2.0 * m : 2.0 * m * (m - 1);
+    for(k = 1; k <= r; k++)
+      A[j][k] = -2.0 * pow(k, m);
+    b[j] = (m == deriv) ? ((deriv == 1) ? -1.0 : -2.0) : 0.0;
+  }
+  for(i = 0; i < n; i++)	{		/* Gaussian elimination with partial pivoting */
+    for(p = i, j = i+1; j < n; j++)
+      if (fabs(A[j][i]) > fabs(A[p][i])) p = j;
+    for(k = 0; k < n; k++)	{
+      t = A[i][k]; A[i][k] = A[p][k]; A[p][k] = t;
+    }
+    t = b[i]; b[i] = b[p]; b[p] = t;
+    for(j = i+1; j < n; j++)	{
+      t = A[j][i] / A[i][i];
+      for(k = i; k < n; k++)
+        A[j][k] -= t * A[i][k];
+      b[j] -= t * b[i];
+    }
+  }
+  for(i = n-1; i >= 0; i--)	{
+    for(k = i+1; k < n; k++)
+      b[i] -= A[i][k] * b[k];
+    b[i] /= A[i][i];
+  }
+  *alpha = b[0];
+  for(k = 1; k <= r; k++)
+    coef[k-1] = b[k];
+  return;
+}
+
+/* stencil of the derivative deriv (1, 2) of the given order (2, 4, 6, 8) for the grid spacing dx, returns -1 if unsupported */
+static inline int fd_stencil_init(fd_stencil_t *st, int deriv, int order, int compact, double dx)	{
+  double x[FD_MAX_POINTS], coef[FD_MAX_RADIUS], scale;
+  int r, j, k;
+
+  if ((deriv != 1 && deriv != 2) || order < 2 || order > FD_MAX_ORDER || order % 2 != 0 || (compact && order < 4))
+    return -1;
+  memset(st, 0, sizeof(fd_stencil_t));
+  st->deriv = deriv;
+  st->order = order;
+  st->compact = compact;
+  st->width = order + deriv;
+  scale = (deriv == 1) ? 1.0 / dx : 1.0 / (dx * dx);
+
+  if (compact)	{
+    r = st->radius = order / 2 - 1;
+    fd_compact_coefficients(deriv, r, &st->alpha, coef);
+    for(k = 1; k <= r; k++)	{
+      st->interior[r+k] = coef[k-1];
+      st->interior[r-k] = (deriv == 1) ? -coef[k-1] : coef[k-1];
+      if (deriv == 2) st->interior[r] -= 2.0 * coef[k-1];
+    }
+  }
+  else	{
+    r = st->radius = order / 2;
+    for(j = 0; j < 2*r+1; j++)
+      x[j] = j - r;
+    fd_weights(deriv, 0.0, x, 2*r+1, st->interior);
+  }
+  for(j = 0; j < 2*r+1; j++)
+    st->interior[j] *= scale;
+
+  /* one-sided closures on the nodes 0..width-1 (left) and -(width-1)..0 (right), relative to the boundary point */
+  for(j = 0; j < st->width; j++)
+    x[j] = j;
+  for(k = 0; k < r; k++)
+    fd_weights(deriv, k, x, st->width, st->left[k]);
+  for(j = 0; j < st->width; j++)
+    x[j] = j - (st->width - 1);
+  for(k = 0; k < r; k++)
+    fd_weights(deriv, -k, x, st->width, st->right[k]);
+  for(k = 0; k < r; k++)
+    for(j = 0; j < st->width; j++)	{
+      st->left[k][j] *= scale;
+      st->right[k][j] *= scale;
+    }
+  return 0;
+}
+
+/* smallest number of points per process: a full ghost layer from each neighbour, and the closures within the first */
+/* process's points and ghosts */
+static inline int fd_min_local_points(const fd_stencil_t *st)	{
+  return (st->width - st->radius > st->radius) ? st->width - st->radius : st->radius;
+}
+
+/* collective: fills the radius ghost points at both ends of U (local points at U[radius .. radius+local_n-1]) */
+static inline void fd_exchange_halo(const fd_stencil_t *st, double *U, int local_n, MPI_Comm comm)	{
+  int my_id, nprocs, left, right, r = st->radius;
+
+  MPI_Comm_rank(comm, &my_id);
+  MPI_Comm_size(comm, &nprocs);
+  left = (my_id == 0) ? MPI_PROC_NULL : my_id - 1;
+  right = (my_id == nprocs-1) ? MPI_PROC_NULL : my_id + 1;
+  MPI_Sendrecv(&U[r], r, MPI_DOUBLE, left, 100, &U[r+local_n], r, MPI_DOUBLE, right, 100, comm, MPI_STATUS_IGNORE);
+  MPI_Sendrecv(&U[local_n], r, MPI_DOUBLE, right, 200, &U[0], r, MPI_DOUBLE, left, 200, comm, MPI_STATUS_IGNORE);
+  return;
+}
+
+/* d[i] = stencil applied at the local point i (global point local_xs+i of 0..nx), U with its ghost points filled: the */
+/* derivative for the explicit schemes, the right-hand side of the tridiagonal system for the compact ones */
+static inline void fd_apply(const fd_stencil_t *st, const double *U, double *d, int local_n, int local_xs, int nx)	{
+  int i, r = st->radius, w = st->width;
+
+#pragma omp parallel for
+  for(i = 0; i < local_n; i++)	{
+    const double *u = &U[r+i];		/* u[k] is the value at the global point g+k */
+    const double *c = st->interior;
+    int g = local_xs + i, j, n = 2*r+1;
+    double s = 0.0;
+
+    if (g < r)	{
+      c = st->left[g];
+      u -= g;
+      n = w;
+    }
+    else if (g > nx - r)	{
+      c = st->right[nx-g];
+      u += nx - g - (w - 1);
+      n = w;
+    }
+    else u -= r;
+    for(j = 0; j < n; j++)
+      s += c[j] * u[j];
+    d[i] = s;
+  }
+  return;
+}
+
+/* compact schemes: factorization of the local block of the tridiagonal system, built once per grid and decomposition */
+typedef struct	{
+  int local_n;
+  double *lower, *upper;	/* row i: lower[i] y_{i-1} + y_i + upper[i] y_{i+1}, lower[0]/upper[local_n-1] couple to the neighbours */
+  double *cp, *inv;		/* Thomas algorithm: modified upper diagonal and inverse pivots of the local block */
+  double *v, *w;		/* local block solutions for the couplings: y = x - v y_left - w y_right */
+} fd_compact_t;
+
+static inline void fd_compact_solve_local(const fd_compact_t *cs, const double *d, double *x)	{
+  int i, n = cs->local_n;
+
+  x[0] = d[0] * cs->inv[0];
+  for(i = 1; i < n; i++)
+    x[i] = (d[i] - cs->lower[i] * x[i-1]) * cs->inv[i];
+  for(i = n-2; i >= 0; i--)
+    x[i] -= cs->cp[i] * x[i+1];
+  return;
+}
+
+static inline void fd_compact_init(fd_compact_t *cs, const fd_stencil_t *st, int local_n, int local_xs, int nx)	{
+  double *e;
+  int i, g, n = local_n;
+
+  cs->local_n = n;
+  cs->lower = calloc(n, sizeof(double));
+  cs->upper = calloc(n, sizeof(double));
+  cs->cp = calloc(n, sizeof(double));
+  cs->inv = calloc(n, sizeof(double));
+  cs->v = calloc(n, sizeof(double));
+  cs->w = calloc(n, sizeof(double));
+  for(i = 0; i < n; i++)	{		/* the closure rows are explicit */
+    g = local_xs + i;
+    if (g >= st->radius && g <= nx - st->radius) cs->lower[i] = cs->upper[i] = st->alpha;
+  }
+  cs->inv[0] = 1.0;
+  for(i = 0; i < n; i++)	{
+    if (i > 0) cs->inv[i] = 1.0 / (1.0 - cs->lower[i] * cs->cp[i-1]);
+    cs->cp[i] = (i < n-1) ? cs->upper[i] * cs->inv[i] : 0.0;
+  }
+  e = calloc(n, sizeof(double));
+  e[0] = cs->lower[0];
+  fd_compact_solve_local(cs, e, cs->v);
+  e[0] = 0.0;
+  e[n-1] += cs->upper[n-1];
+  fd_compact_solve_local(cs, e, cs->w);
+  free(e);
+  return;
+}
+
+static inline void fd_compact_free(fd_compact_t *cs)	{
+  free(cs->lower);
+  free(cs->upper);
+  free(cs->cp);
+  free(cs->inv);
+  free(cs->v);
+  free(cs->w);
+  return;
+}
+
+/* collective: solves the tridiagonal system of the compact scheme for the right-hand side d (from fd_apply), y = derivative */
+static inline void fd_compact_solve(const fd_compact_t *cs, const double *d, double *y, MPI_Comm comm)	{
+  double ends[6], bounds[2], *all = NULL, *band = NULL, *z = NULL, f;
+  int my_id, nprocs, i, j, k, n = cs->local_n, N;
+
+  MPI_Comm_rank(comm, &my_id);
+  MPI_Comm_size(comm, &nprocs);
+  fd_compact_solve_local(cs, d, y);
+  bounds[0] = bounds[1] = 0.0;
+  if (nprocs > 1)	{
+    /* first and last value of every block: y_first = x_0 - v_0 L_{p-1} - w_0 F_{p+1}, the same for y_last */
+    ends[0] = y[0]; ends[1] = cs->v[0]; ends[2] = cs->w[0];
+    ends[3] = y[n-1]; ends[4] = cs->v[n-1]; ends[5] = cs->w[n-1];
+    if (my_id == 0) all = malloc(6 * nprocs * sizeof(double));
+    MPI_Gather(ends, 6, MPI_DOUBLE, all, 6, MPI_DOUBLE, 0, comm);
+    if (my_id == 0)	{
+      /* unknowns z[2p] = F_p, z[2p+1] = L_p: a band matrix with two diagonals on each side, diagonally dominant */
+      N = 2 * nprocs;
+      band = calloc(5 * N, sizeof(double));	/* band[5r + 2 + c - r] = A[r][c] */
+      z = malloc(N * sizeof(double));
+      for(i = 0; i < nprocs; i++)
+        for(k = 0; k < 2; k++)	{
+          j = 2 * i + k;
+          band[5*j + 2] = 1.0;
+          if (i > 0) band[5*j + 2 + (2*i-1) - j] = all[6*i + 3*k + 1];
+          if (i < nprocs-1) band[5*j + 2 + (2*i+2) - j] = all[6*i + 3*k + 2];
+          z[j] = all[6*i + 3*k];
+        }
+      for(j = 0; j < N; j++)		/* elimination without pivoting */
+        for(i = j+1; i < N && i <= j+2; i++)	{
+          f = band[5*i + 2 + j - i] / band[5*j + 2];
+          for(k = j; k < N && k <= j+2; k++)
+            band[5*i + 2 + k - i] -= f * band[5*j + 2 + k - j];
+          z[i] -= f * z[j];
+        }
+      for(j = N-1; j >= 0; j--)	{
+        for(k = j+1; k < N && k <= j+2; k++)
+          z[j] -= band[5*j + 2 + k - j] * z[k];
+        z[j] /= band[5*j + 2];
+      }
+      for(i = 0; i < nprocs; i++)	{	/* L_{p-1} and F_{p+1} of process p */
+        all[2*i] = (i > 0) ? z[2*i-1] : 0.0;
+        all[2*i+1] = (i < nprocs-1) ? z[2*i+2] : 0.0;
+      }
+      free(band);
+      free(z);
+    }
+    MPI_Scatter(all, 2, MPI_DOUBLE, bounds, 2, MPI_DOUBLE, 0, comm);
+    free(all);
+  }
+#pragma omp parallel for
+  for(i = 0; i < n; i++)
+    y[i] -= cs->v[i] * bounds[0] + cs->w[i] * bounds[1];
+  return;
+}
+
+#endif
@@ -0,0 +1,201 @@
+// Batch of integration tasks shared by the derived datatype quadrature programs
+// A task is one (a, b, n) triple. The root reads the tasks from a text file (one "a b n" per line, '#' starts a comment) and
+// broadcasts them all at once as an array of a derived datatype. The tasks are then handed out dynamically: the root is a
+// manager that only serves the next chunk of task indices to the worker processes on request (as in the adaptive quadrature
+// program), so workers that get cheap tasks simply ask more often. The manager computes nothing, so a request never waits
+// behind a long integral (there is no asynchronous progress to serve it otherwise). Each worker keeps (task index, result)
+// pairs, which are collected on the root with a single MPI_Gatherv.
+#ifndef INTEGRAL_TASKS_H
+#define INTEGRAL_TASKS_H
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stddef.h>
+#include <mpi.h>
+#include "benchmark.h"
+
+#define TASKS_TAG_REQUEST 301		/* worker -> manager: next chunk please */
+#define TASKS_TAG_CHUNK 302		/* manager -> worker: first task index of the chunk, -1 when there is none left */
+
+typedef struct	{
+  double a, b;		/* integration limits */
+  int n;		/* number of divisions */
+} integral_task_t;
+
+/* integral of the program's function over [a, b] with n divisions, computed by one process, summed exactly if exact is set */
+typedef double (*task_rule_t)(double a, double b, int n, int exact);
+
+/* root: reads the tasks of a file, returns their number (-1 if the file cannot be opened) */
+static inline int read_tasks(const char *path, integral_task_t **tasks_p)	{
+  FILE *fptr = fopen(path, "r");
+  integral_task_t *tasks = NULL, t;
+  int ntasks = 0, capacity = 0;
+  char line[256];
+
+  if (fptr == NULL) return -1;
+  while (fgets(line, sizeof(line), fptr) != NULL)	{
+    if (sscanf(line, "%lf %lf %d", &t.a, &t.b, &t.n) != 3) continue;	/* comments and blank lines */
+    if (ntasks == capacity)	{
+      capacity = capacity ? 2 * capacity : 1024;
+      tasks = realloc(tasks, capacity * sizeof(integral_task_t));
+    }
+    tasks[ntasks++] = t;
+  }
+  fclose(fptr);
+  *tasks_p = tasks;
+  return ntasks;
+}
+
+/* datatype of one task; resized to the extent of the C struct, so that arrays of tasks can be sent */
+static inline void create_task_mpi_type(MPI_Datatype *task_type_p)	{
+  int block_lengths[3] = {1, 1, 1};
+  MPI_Datatype types[3] = {MPI_DOUBLE, MPI_DOUBLE, MPI_INT}, struct_type;
+  MPI_Aint displacements[3] = {offsetof(integral_task_t, a), offsetof(integral_task_t, b), offsetof(integral_task_t, n)};
+
+  MPI_Type_create_struct(3, block_lengths, displacements, types, &struct_type);
+  MPI_Type_create_resized(struct_type, 0, sizeof(integral_task_t), task_type_p);
+  MPI_Type_commit(task_type_p);
+  MPI_Type_free(&struct_type);
+  return;
+}
+
+/* collective: the tasks of the root (ntasks of them) to every process in one broadcast, returns ntasks */
+static inline int bcast_tasks(integral_task_t **tasks_p, int ntasks, MPI_Comm comm)	{
+  MPI_Datatype task_type;
+  int my_id;
+
+  MPI_Comm_rank(comm, &my_id);
+  MPI_Bcast(&ntasks, 1, MPI_INT, 0, comm);
+  if (ntasks <= 0) return ntasks;
+  if (my_id != 0) *tasks_p = malloc(ntasks * sizeof(integral_task_t));
+  create_task_mpi_type(&task_type);
+  MPI_Bcast(*tasks_p, ntasks, task_type, 0, comm);
+  MPI_Type_free(&task_type);
+  return ntasks;
+}
+
+/* collective: computes all tasks with dynamic scheduling, chunk tasks per request to the manager, each summed exactly if exact */
+/* is set; the results in task */
+/* order are returned on the root (NULL elsewhere). counts is only used on the root, where it must hold nprocs entries */
+/* (the number of tasks of every process, 0 for the manager); the other processes may pass NULL */
+static inline double *run_tasks(task_rule_t rule, const integral_task_t *tasks, int ntasks, int chunk, int exact, int *counts, MPI_Comm comm)	{
+  int my_id, nprocs, next, active, local_count = 0, capacity = 64, *recv_counts = NULL, *displs = NULL;
+  double *local = malloc(2 * capacity * sizeof(double)), *all = NULL, *results = NULL;
+  MPI_Status status;
+
+  MPI_Comm_rank(comm, &my_id);
+  MPI_Comm_size(comm, &nprocs);
+  if (my_id == 0 && nprocs > 1)	{	/* manager: serves chunks until every worker has been told to stop */
+    for(next = 0, active = nprocs-1; active > 0; )	{
+      MPI_Recv(NULL, 0, MPI_INT, MPI_ANY_SOURCE, TASKS_TAG_REQUEST, comm, &status);
+      if (next < ntasks)	{
+	MPI_Send(&next, 1, MPI_INT, status.MPI_SOURCE, TASKS_TAG_CHUNK, comm);
+	next += chunk;
+      }
+      else	{
+	MPI_Send(&(int){-1}, 1, MPI_INT, status.MPI_SOURCE, TASKS_TAG_CHUNK, comm);
+	active--;
+      }
+    }
+  }
+  else	{		/* worker, or the only process */
+    for(next = 0; ; next += chunk)	{
+      if (nprocs > 1)	{
+	MPI_Send(NULL, 0, MPI_INT, 0, TASKS_TAG_REQUEST, comm);
+	MPI_Recv(&next, 1, MPI_INT, 0, TASKS_TAG_CHUNK, comm, MPI_STATUS_IGNORE);
+      }
+      if (next < 0 || next >= ntasks) break;
+      for(int t = next; t < next + chunk && t < ntasks; t++)	{
+	if (local_count == capacity)	{
+	  capacity *= 2;
+	  local = realloc(local, 2 * capacity * sizeof(double));
+	}
+	local[2*local_count] = t;
+	local[2*local_count+1] = rule(tasks[t].a, tasks[t].b, tasks[t].n, exact);
+	local_count++;
+      }
+    }
+  }
+
+  /* (index, result) pairs of all processes on the root */
+  local_count *= 2;
+  if (my_id == 0)	{
+    recv_counts = malloc(nprocs * sizeof(int));
+    displs = malloc(nprocs * sizeof(int));
+  }
+  MPI_Gather(&local_count, 1, MPI_INT, recv_counts, 1, MPI_INT, 0, comm);
+  if (my_id == 0)	{
+    displs[0] = 0;
+    for(int r = 1; r < nprocs; r++) displs[r] = displs[r-1] + recv_counts[r-1];
+    all = malloc((displs[nprocs-1] + recv_counts[nprocs-1] + 1) * sizeof(double));
+  }
+  MPI_Gatherv(local, local_count, MPI_DOUBLE, all, recv_counts, displs, MPI_DOUBLE, 0, comm);
+
+  if (my_id == 0)	{
+    results = malloc(ntasks * sizeof(double));
+    for(int r = 0; r < nprocs; r++)	{
+      counts[r] = recv_counts[r] / 2;
+      for(int i = displs[r]; i < displs[r] + recv_counts[r]; i += 2) results[(int)all[i]] = all[i+1];
+    }
+    free(all);
+    free(recv_counts);
+    free(displs);
+  }
+  free(local);
+  return results;
+}
+
+/* collective: batch mode of a program, the tasks of the file path are computed (timed by the benchmark harness) and the */
+/* lines "a b n integral" are written in task order to out_path (stdout if NULL); exact selects the reproducible summation */
+/* of every task (as -sum exact); returns -1 if there are no tasks */
+static inline int run_task_file(task_rule_t rule, const char *path, const char *out_path, int chunk, int exact, const char *program, int argc, char *argv[], MPI_Comm comm)	{
+  integral_task_t *tasks = NULL;
+  double *results = NULL;
+  int my_id, nprocs, ntasks = 0, *counts = NULL, min_count, max_count;
+  bench_t bench;
+  FILE *fptr;
+
+  MPI_Comm_rank(comm, &my_id);
+  MPI_Comm_size(comm, &nprocs);
+  if (my_id == 0)	{
+    ntasks = read_tasks(path, &tasks);
+    if (ntasks <= 0) printf("No integration tasks could be read from '%s'.\n", path);
+    counts = malloc(nprocs * sizeof(int));
+  }
+  ntasks = bcast_tasks(&tasks, ntasks, comm);
+  if (ntasks <= 0)	{
+    free(counts);
+    return -1;
+  }
+  if (chunk < 1) chunk = 1;
+
+  bench_init(&bench, argc, argv, 1, 10);
+  while (bench_next(&bench, comm))	{
+    free(results);
+    results = run_tasks(rule, tasks, ntasks, chunk, exact, counts, comm);
+  }
+  bench_report(&bench, program, exact ? "tasks-exact" : "tasks-naive", ntasks, comm);
+  bench_free(&bench);
+
+  if (my_id == 0)	{
+    fptr = out_path ? fopen(out_path, "w") : stdout;
+    if (fptr == NULL) fptr = stdout;
+    for(int t = 0; t < ntasks; t++)
+      fprintf(fptr, "%.17g %.17g %d %.17g\n", tasks[t].a, tasks[t].b, tasks[t].n, results[t]);
+    if (fptr != stdout) fclose(fptr);
+    min_count = max_count = counts[nprocs > 1 ? 1 : 0];	/* the workers; the manager computes no task */
+    for(int r = (nprocs > 1) ? 2 : 1; r < nprocs; r++)	{
+      if (counts[r] < min_count) min_count = counts[r];
+      if (counts[r] > max_count) max_count = counts[r];
+    }
+    printf("\n%d integrals of '%s' computed (%d per request, %s summation), tasks per worker: min = %d, max = %d%s%s\n", ntasks, path, chunk,
+	   exact ? "exact" : "naive",
+	   min_count, max_count, out_path ? ", results written to " : "", out_path ? out_path : "");
+  }
+  free(tasks);
+  free(results);
+  free(counts);
+  return 0;
+}
+
+#endif
@@ -0,0 +1,85 @@
+// Romberg integration shared by the quadrature programs
+// The trapezoidal estimate T_k with n_k = n_0 * 2^k divisions is refined from T_{k-1}: only the n_{k-1} new midpoints are
+// evaluated, T_k = T_{k-1} / 2 + h_k * (sum of f at the midpoints), so no evaluation of a previous level is thrown away.
+// Richardson extrapolation of the T_k, R[k][j] = R[k][j-1] + (R[k][j-1] - R[k-1][j-1]) / (4^j - 1) (column 1 is Simpson's rule),
+// stops at the first level where two successive diagonal values agree within the tolerance. Every process evaluates its block
+// of the new points (batched, Common/batch_eval.h), the level sums are reduced to the root, which runs the extrapolation and
+// broadcasts whether to go on.
+#ifndef ROMBERG_H
+#define ROMBERG_H
+
+#include <math.h>
+#include <mpi.h>
+#include "batch_eval.h"
+#include "exact_sum.h"
+
+#define ROMBERG_MAX_LEVELS 25		/* n_0 * 2^24 divisions at most */
+
+typedef struct	{
+  double value;			/* extrapolated integral, on the root */
+  double error;			/* |R[k][k] - R[k-1][k-1]| of the last level, on the root */
+  int levels;			/* levels computed */
+  long n;			/* divisions of the last level */
+  long evals;			/* function evaluations over all processes */
+  long rerun_evals;		/* evaluations of independent runs with n_0, 2n_0, ..., n divisions */
+} romberg_result_t;
+
+/* collective: sum of f(x0 + j*step) for j = 0..count-1 on the root, every process evaluates its block of batches */
+/* exact selects the reproducible summation of batch_strided_deposit/exact_sum_reduce, otherwise MPI_SUM of the local sums */
+static inline double romberg_level_sum(batch_func_t f, double x0, double step, long count, int exact, MPI_Comm comm)	{
+  int my_id, nprocs;
+  long first, local_count;
+  double local_sum, sum = 0.0;
+  exact_sum_t acc;
+
+  MPI_Comm_rank(comm, &my_id);
+  MPI_Comm_size(comm, &nprocs);
+  batch_block_range(count, nprocs, my_id, &first, &local_count);
+  if (exact)	{
+    exact_sum_init(&acc);
+    batch_strided_deposit(f, x0, step, first, local_count, 1.0, &acc);
+    return exact_sum_reduce(&acc, 0, comm);
+  }
+  local_sum = batch_strided_sum(f, x0 + first * step, step, local_count);
+  MPI_Reduce(&local_sum, &sum, 1, MPI_DOUBLE, MPI_SUM, 0, comm);
+  return sum;
+}
+
+/* collective: integral of f over [a, b] to the absolute tolerance tol, starting from n0 divisions */
+static inline romberg_result_t romberg(batch_func_t f, double a, double b, long n0, double tol, int exact, MPI_Comm comm)	{
+  double R[ROMBERG_MAX_LEVELS][ROMBERG_MAX_LEVELS], h, sum, x[2] = {a, b}, fx[2], p4;
+  int my_id, k, j, done = 0;
+  romberg_result_t res = {0.0, 0.0, 0, 0, 0, 0};
+
+  MPI_Comm_rank(comm, &my_id);
+  h = (b - a) / n0;
+  sum = romberg_level_sum(f, a + h, h, n0 - 1, exact, comm);	/* interior points of level 0 */
+  if (my_id == 0)	{
+    f(x, fx, 2);
+    R[0][0] = h * (0.5 * (fx[0] + fx[1]) + sum);
+    res.value = R[0][0];
+  }
+  res.n = n0;
+  res.evals = res.rerun_evals = n0 + 1;
+
+  for(k = 1; k < ROMBERG_MAX_LEVELS && !done; k++)	{
+    sum = romberg_level_sum(f, a + 0.5 * h, h, res.n, exact, comm);	/* the midpoints of the previous level */
+    h *= 0.5;
+    res.evals += res.n;
+    res.n *= 2;
+    res.rerun_evals += res.n + 1;
+    if (my_id == 0)	{
+      R[k][0] = 0.5 * R[k-1][0] + h * sum;
+      for(j = 1, p4 = 4.0; j <= k; j++, p4 *= 4.0)
+	R[k][j] = R[k][j-1] + (R[k][j-1] - R[k-1][j-1]) / (p4 - 1.0);
+      res.value = R[k][k];
+      res.error = fabs(R[k][k] - R[k-1][k-1]);
+      done = (res.error <= tol);
+    }
+    MPI_Bcast(&done, 1, MPI_INT, 0, comm);
+  }
+  res.levels = k;
+  return res;
+}
+
+#endif
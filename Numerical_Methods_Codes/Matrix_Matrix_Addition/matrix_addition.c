@@ -2,25 +2,141 @@
 // row-wise block parallelization
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
 #include <time.h>
 #include <math.h>
 #include <mpi.h>
+#include <sys/resource.h>
+#include "../Common/block_decomposition.h"
+#include "../Common/benchmark.h"
+#ifdef _OPENMP
+#include <omp.h>
+#else
+#define omp_get_max_threads() 1
+#define omp_get_num_threads() 1
+#define omp_get_thread_num() 0
+#endif
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define HAVE_X86_SIMD 1
+#endif
 
-void allocate_memory(double **local_A_pp, double **local_B_pp, double **local_C_pp, int local_m, int n, MPI_Comm comm)	{
-  *local_A_pp = malloc(local_m * n * sizeof(double));
-  *local_B_pp = malloc(local_m * n * sizeof(double));
-  *local_C_pp = malloc(local_m * n * sizeof(double));
+/* fused streaming kernel: C = alpha*A + beta*B over count contiguous elements, streaming = 1 uses non-temporal stores for C */
+typedef void (*stream_kernel_t)(long count, double alpha, const double *A, double beta, const double *B, double *C, int streaming);
+
+/* 64-byte aligned blocks (for the non-temporal stores), first touched by the threads with the same static */
+/* partition as the streaming kernel, so that every page lives on the NUMA domain of the thread using it */
+void allocate_memory(double **local_A_pp, double **local_B_pp, double **local_C_pp, int local_m, int n)	{
+  size_t bytes = ((size_t)local_m * n * sizeof(double) + 63) / 64 * 64 + 64;	/* never zero, for empty row blocks */
+  double *A, *B, *C;
+  long i;
+
+  A = *local_A_pp = aligned_alloc(64, bytes);
+  B = *local_B_pp = aligned_alloc(64, bytes);
+  C = *local_C_pp = aligned_alloc(64, bytes);
+
+#pragma omp parallel for schedule(static)
+  for(i = 0; i < (long)local_m * n; i++)	{
+    A[i] = 0.0;
+    B[i] = 0.0;
+    C[i] = 0.0;
+  }
+  return;
+}
+
+/* binary matrix file: a header of 3 int64 words (magic, rows, columns) followed by the rows x columns doubles in row-major order */
+#define MATRIX_FILE_MAGIC 0x314658495254414DLL	/* "MATRIXF1" in little-endian byte order */
+#define MATRIX_FILE_HEADER (3 * (MPI_Offset)sizeof(int64_t))
+
+/* collective: reads the dimensions stored in the header of a matrix file, returns 0 if the file can not be used */
+int read_matrix_header(const char *file_name, int *rows_p, int *cols_p, MPI_Comm comm)	{
+  MPI_File fh;
+  int64_t header[3];
+
+  if (MPI_File_open(comm, file_name, MPI_MODE_RDONLY, MPI_INFO_NULL, &fh) != MPI_SUCCESS) return 0;
+  MPI_File_read_at_all(fh, 0, header, 3, MPI_INT64_T, MPI_STATUS_IGNORE);
+  MPI_File_close(&fh);
+  if (header[0] != MATRIX_FILE_MAGIC || header[1] <= 0 || header[2] <= 0) return 0;
+
+  *rows_p = (int)header[1];
+  *cols_p = (int)header[2];
+  return 1;
+}
+
+/* file view selecting the rows x cols block at (row_s, col_s) of the global m x n matrix, returns the number of local elements */
+int set_block_view(MPI_File fh, int m, int n, int row_s, int rows, int col_s, int cols)	{
+  int sizes[2] = {m, n}, subsizes[2] = {rows, cols}, starts[2] = {row_s, col_s};
+  MPI_Datatype block_type;
+
+  if (rows <= 0 || cols <= 0)	{	/* empty block: the process still takes part in the collective call */
+    MPI_File_set_view(fh, MATRIX_FILE_HEADER, MPI_DOUBLE, MPI_DOUBLE, "native", MPI_INFO_NULL);
+    return 0;
+  }
+
+  MPI_Type_create_subarray(2, sizes, subsizes, starts, MPI_ORDER_C, MPI_DOUBLE, &block_type);
+  MPI_Type_commit(&block_type);
+  MPI_File_set_view(fh, MATRIX_FILE_HEADER, MPI_DOUBLE, block_type, "native", MPI_INFO_NULL);
+  MPI_Type_free(&block_type);
+  return rows * cols;
+}
+
+/* collective: every process reads its own block of the global m x n matrix directly from the file */
+void read_matrix_block(const char *file_name, double *local_M, int m, int n, int row_s, int rows, int col_s, int cols, MPI_Comm comm)	{
+  MPI_File fh;
+  int count;
+
+  MPI_File_open(comm, file_name, MPI_MODE_RDONLY, MPI_INFO_NULL, &fh);
+  count = set_block_view(fh, m, n, row_s, rows, col_s, cols);
+  MPI_File_read_at_all(fh, 0, local_M, count, MPI_DOUBLE, MPI_STATUS_IGNORE);
+  MPI_File_close(&fh);
+  return;
+}
+
+/* collective: every process writes its own block of the global m x n matrix, the root writes the header */
+void write_matrix_block(const char *file_name, double *local_M, int m, int n, int row_s, int rows, int col_s, int cols, MPI_Comm comm)	{
+  MPI_File fh;
+  int my_id, count;
+  int64_t header[3] = {MATRIX_FILE_MAGIC, m, n};
+
+  MPI_Comm_rank(comm, &my_id);
+  MPI_File_open(comm, file_name, MPI_MODE_CREATE | MPI_MODE_WRONLY, MPI_INFO_NULL, &fh);
+  MPI_File_set_size(fh, 0);
+  if (my_id == 0) MPI_File_write_at(fh, 0, header, 3, MPI_INT64_T, MPI_STATUS_IGNORE);
+  count = set_block_view(fh, m, n, row_s, rows, col_s, cols);
+  MPI_File_write_at_all(fh, 0, local_M, count, MPI_DOUBLE, MPI_STATUS_IGNORE);
+  MPI_File_close(&fh);
+  return;
+}
+
+/* distributed initialization: each process generates only its own row block, no process holds the full matrices */
+void populate_local_blocks(double *local_A, double *local_B, int local_m, int n)	{
+  int i, j;
+
+#pragma omp parallel for private(j)
+  for(i = 0; i < local_m; i++)	{
+    for(j = 0; j < n; j++)	{
+      local_A[i*n+j] = 5.0;	/* for simplicity and sanity check, it is kept as 5.0 */
+      local_B[i*n+j] = 5.0;	/* for simplicity and sanity check, it is kept as 5.0 */
+    }
+  }
   return;
 }
 
+/* reference initialization: the root builds the full m x n matrices and scatters the row blocks */
 void populate_matrices(double *local_A, double *local_B, int m, int local_m, int n, int my_id, MPI_Comm comm)	{
   double* matA = NULL;
   double* matB = NULL;
-  int i, j;
+  int i, j, nprocs;
+  int *counts = NULL, *displs = NULL;
    
+  MPI_Comm_size(comm, &nprocs);
   if (my_id == 0)	{
-    matA = malloc(m * n * sizeof(double));
-    matB = malloc(m * n * sizeof(double));    
+    matA = malloc((size_t)m * n * sizeof(double));
+    matB = malloc((size_t)m * n * sizeof(double));    
+    counts = malloc(nprocs * sizeof(int));
+    displs = malloc(nprocs * sizeof(int));
+    block_counts(m, nprocs, n, counts, displs);	/* balanced row blocks */
 
     for(i = 0; i < m; i++)	{
       for(j = 0; j < n; j++)	{
@@ -29,33 +145,36 @@ void populate_matrices(double *local_A, double *local_B, int m, int local_m, int
       }
     }
     
-    MPI_Scatter(matA, local_m*n, MPI_DOUBLE, local_A, local_m*n, MPI_DOUBLE, 0, comm);
-    MPI_Scatter(matB, local_m*n, MPI_DOUBLE, local_B, local_m*n, MPI_DOUBLE, 0, comm);
-    free(matA);
-    free(matB);
   }
-  else	{
-    MPI_Scatter(NULL, local_m*n, MPI_DOUBLE, local_A, local_m*n, MPI_DOUBLE, 0, comm);
-    MPI_Scatter(NULL, local_m*n, MPI_DOUBLE, local_B, local_m*n, MPI_DOUBLE, 0, comm);
-  }   
+  MPI_Scatterv(matA, counts, displs, MPI_DOUBLE, local_A, local_m*n, MPI_DOUBLE, 0, comm);
+  MPI_Scatterv(matB, counts, displs, MPI_DOUBLE, local_B, local_m*n, MPI_DOUBLE, 0, comm);
+  free(matA);
+  free(matB);
+  free(counts);
+  free(displs);
   return;
 }
     
 void mat_add(double* local_A, double* local_B, double* local_C, int m, int local_m, int n, int my_id, MPI_Comm comm)	{
-  double* global_C = NULL;
   int i, j;
 
+  (void)m; (void)my_id; (void)comm;	/* only used by the printing below */
+
+#pragma omp parallel for private(j)
   for(i = 0; i < local_m; i++)	
     for(j = 0; j < n; j++)	
       local_C[i*n+j] = local_A[i*n+j] + local_B[i*n+j];
 
-  /* if (my_id == 0)	{	// user can turn off the comment for printing the obtained global matrix
+  /* double* global_C = NULL;	// user can turn off the comment for printing the obtained global matrix
+  int nprocs, *counts = NULL, *displs = NULL;
+  MPI_Comm_size(comm, &nprocs);
+  if (my_id == 0)	{
     global_C = malloc(m * n * sizeof(double));
-    MPI_Gather(local_C, local_m*n, MPI_DOUBLE, global_C, local_m*n, MPI_DOUBLE, 0, comm);
-  }
-  else	{
-    MPI_Gather(local_C, local_m*n, MPI_DOUBLE, NULL, local_m*n, MPI_DOUBLE, 0, comm);
+    counts = malloc(nprocs * sizeof(int));
+    displs = malloc(nprocs * sizeof(int));
+    block_counts(m, nprocs, n, counts, displs);
   }
+  MPI_Gatherv(local_C, local_m*n, MPI_DOUBLE, global_C, counts, displs, MPI_DOUBLE, 0, comm);
 
   MPI_Barrier(comm);
 
@@ -68,40 +187,359 @@ void mat_add(double* local_A, double* local_B, double* local_C, int m, int local
     }
 
     free(global_C);
+    free(counts);
+    free(displs);
   }	*/
   return;
 }
 
+/* startup cost of the initialization: slowest process and largest peak resident memory (ru_maxrss is in kB on Linux) */
+void report_init_cost(double init_time, const char *init_mode, int my_id, MPI_Comm comm)	{
+  struct rusage usage;
+  double max_time, rss, max_rss;
+
+  getrusage(RUSAGE_SELF, &usage);
+  rss = usage.ru_maxrss / 1024.0;
+  MPI_Reduce(&init_time, &max_time, 1, MPI_DOUBLE, MPI_MAX, 0, comm);
+  MPI_Reduce(&rss, &max_rss, 1, MPI_DOUBLE, MPI_MAX, 0, comm);
+  if (my_id == 0) printf("Initialization (%s) time = %lf, peak RSS (max over processes) = %.1lf MB\n", init_mode, max_time, max_rss);
+  return;
+}
+
+/* portable kernel; with SSE2 (every x86-64 CPU) its streaming path writes C with non-temporal stores, */
+/* elsewhere there is no portable non-temporal store and C is written with regular stores */
+void stream_kernel_scalar(long count, double alpha, const double *A, double beta, const double *B, double *C, int streaming)	{
+  long i = 0;
+
+#if defined(HAVE_X86_SIMD) && defined(__SSE2__)
+  if (streaming)	{
+    for(; i < count && ((uintptr_t)&C[i] & 15) != 0; i++)	/* peel until C is 16-byte aligned */
+      C[i] = alpha * A[i] + beta * B[i];
+    for(; i+2 <= count; i += 2)
+      _mm_stream_pd(&C[i], _mm_set_pd(alpha * A[i+1] + beta * B[i+1], alpha * A[i] + beta * B[i]));
+    _mm_sfence();
+  }
+#else
+  (void)streaming;
+#endif
+#pragma omp simd
+  for(long j = i; j < count; j++)
+    C[j] = alpha * A[j] + beta * B[j];
+  return;
+}
+
+#ifdef HAVE_X86_SIMD
+__attribute__((target("avx2,fma")))
+void stream_kernel_avx2(long count, double alpha, const double *A, double beta, const double *B, double *C, int streaming)	{
+  __m256d va = _mm256_set1_pd(alpha), vb = _mm256_set1_pd(beta);
+  long i = 0;
+
+  for(; i < count && ((uintptr_t)&C[i] & 31) != 0; i++)	/* peel until C is 32-byte aligned */
+    C[i] = alpha * A[i] + beta * B[i];
+  if (streaming)	{
+    for(; i+4 <= count; i += 4)
+      _mm256_stream_pd(&C[i], _mm256_fmadd_pd(va, _mm256_loadu_pd(&A[i]), _mm256_mul_pd(vb, _mm256_loadu_pd(&B[i]))));
+    _mm_sfence();
+  }
+  else	{
+    for(; i+4 <= count; i += 4)
+      _mm256_store_pd(&C[i], _mm256_fmadd_pd(va, _mm256_loadu_pd(&A[i]), _mm256_mul_pd(vb, _mm256_loadu_pd(&B[i]))));
+  }
+  for(; i < count; i++)
+    C[i] = alpha * A[i] + beta * B[i];
+  return;
+}
+
+__attribute__((target("avx512f")))
+void stream_kernel_avx512(long count, double alpha, const double *A, double beta, const double *B, double *C, int streaming)	{
+  __m512d va = _mm512_set1_pd(alpha), vb = _mm512_set1_pd(beta);
+  long i = 0;
+
+  for(; i < count && ((uintptr_t)&C[i] & 63) != 0; i++)	/* peel until C is 64-byte aligned */
+    C[i] = alpha * A[i] + beta * B[i];
+  if (streaming)	{
+    for(; i+8 <= count; i += 8)
+      _mm512_stream_pd(&C[i], _mm512_fmadd_pd(va, _mm512_loadu_pd(&A[i]), _mm512_mul_pd(vb, _mm512_loadu_pd(&B[i]))));
+    _mm_sfence();
+  }
+  else	{
+    for(; i+8 <= count; i += 8)
+      _mm512_store_pd(&C[i], _mm512_fmadd_pd(va, _mm512_loadu_pd(&A[i]), _mm512_mul_pd(vb, _mm512_loadu_pd(&B[i]))));
+  }
+  for(; i < count; i++)
+    C[i] = alpha * A[i] + beta * B[i];
+  return;
+}
+#endif
+
+/* picks the widest kernel supported by the running CPU, unless the user forces one */
+stream_kernel_t select_stream_kernel(const char *name, const char **chosen_p)	{
+#ifdef HAVE_X86_SIMD
+  __builtin_cpu_init();
+  int has_avx512 = __builtin_cpu_supports("avx512f");
+  int has_avx2 = __builtin_cpu_supports("avx2") && __builtin_cpu_supports("fma");
+
+  if ((strcmp(name, "auto") == 0 || strcmp(name, "avx512") == 0) && has_avx512)	{
+    *chosen_p = "avx512";
+    return stream_kernel_avx512;
+  }
+  if ((strcmp(name, "auto") == 0 || strcmp(name, "avx512") == 0 || strcmp(name, "avx2") == 0) && has_avx2)	{
+    *chosen_p = "avx2";
+    return stream_kernel_avx2;
+  }
+#endif
+  *chosen_p = "scalar";
+  return stream_kernel_scalar;
+}
+
+/* fused matrix addition on the flat row block, C = alpha*A + beta*B (C may alias A for the in-place A += B) */
+/* each thread works on the same contiguous static chunk it first touched in allocate_memory */
+void mat_add_fused(stream_kernel_t kernel, double alpha, double *local_A, double beta, double *local_B, double *local_C, long count)	{
+  int streaming = (local_C != local_A);	/* in-place updates re-read the lines, so they use regular stores */
+
+#pragma omp parallel
+  {
+    int nthreads = omp_get_num_threads(), tid = omp_get_thread_num();
+    long s = count * tid / nthreads, e = count * (tid + 1) / nthreads;
+    kernel(e - s, alpha, &local_A[s], beta, &local_B[s], &local_C[s], streaming);
+  }
+  return;
+}
+
+/* STREAM-style "add" baseline (c = a + b, plain compiled loop) on arrays of the same size, best of ntrials, aggregate GB/s */
+double stream_baseline(long count, int ntrials, MPI_Comm comm)	{
+  double *a, *b, *c, t0, time, best = 1.0e30, max_best, gbs;
+  long i;
+  int my_id, nprocs;
+
+  MPI_Comm_rank(comm, &my_id);
+  MPI_Comm_size(comm, &nprocs);
+  a = malloc(count * sizeof(double));
+  b = malloc(count * sizeof(double));
+  c = malloc(count * sizeof(double));
+
+#pragma omp parallel for schedule(static)
+  for(i = 0; i < count; i++)	{
+    a[i] = 1.0;
+    b[i] = 2.0;
+    c[i] = 0.0;
+  }
+
+  for(int trial = 0; trial < ntrials; trial++)	{
+    MPI_Barrier(comm);	/* all processes of the node load the memory at the same time */
+    t0 = MPI_Wtime();
+#pragma omp parallel for schedule(static)
+    for(i = 0; i < count; i++)
+      c[i] = a[i] + b[i];
+    time = MPI_Wtime() - t0;
+    if (time < best) best = time;
+  }
+
+  MPI_Reduce(&best, &max_best, 1, MPI_DOUBLE, MPI_MAX, 0, comm);
+  gbs = 3.0 * sizeof(double) * count * (double)nprocs / max_best * 1.0e-9;
+  free(a);
+  free(b);
+  free(c);
+  return gbs;
+}
+
+/* vectorized addition of one tile */
+void add_tile(const double *restrict tile_A, const double *restrict tile_B, double *restrict tile_C, int count)	{
+  int i;
+
+#pragma omp parallel for simd
+  for(i = 0; i < count; i++)
+    tile_C[i] = tile_A[i] + tile_B[i];
+  return;
+}
+
+/* out-of-core addition: the row block of each process is streamed from the files in tiles of tile_size elements, so only */
+/* 6 tiles are resident; the reads of tile t+1 and the write of tile t-1 are in flight (non-blocking MPI-IO) while tile t is added */
+void out_of_core_add(const char *file_A, const char *file_B, const char *file_C, int m, int row_s, int local_m, int n, int tile_size, int my_id, MPI_Comm comm)	{
+  MPI_File fh_A, fh_B, fh_C;
+  MPI_Request read_req[2][2], write_req[2] = {MPI_REQUEST_NULL, MPI_REQUEST_NULL};
+  MPI_Offset block_size, first, offset;
+  int64_t header[3] = {MATRIX_FILE_MAGIC, m, n};
+  double *tile_A[2], *tile_B[2], *tile_C[2];
+  double start, time, max_time;
+  int t, ntiles, cur, count, next_count;
+
+  block_size = (MPI_Offset)local_m * n;		/* elements of the row block, contiguous in the files */
+  first = MATRIX_FILE_HEADER + (MPI_Offset)row_s * n * sizeof(double);
+  ntiles = (int)((block_size + tile_size - 1) / tile_size);
+  for(t = 0; t < 2; t++)	{
+    tile_A[t] = malloc(tile_size * sizeof(double));
+    tile_B[t] = malloc(tile_size * sizeof(double));
+    tile_C[t] = malloc(tile_size * sizeof(double));
+  }
+
+  MPI_Barrier(comm);
+  start = MPI_Wtime();
+  MPI_File_open(comm, file_A, MPI_MODE_RDONLY, MPI_INFO_NULL, &fh_A);
+  MPI_File_open(comm, file_B, MPI_MODE_RDONLY, MPI_INFO_NULL, &fh_B);
+  MPI_File_open(comm, file_C, MPI_MODE_CREATE | MPI_MODE_WRONLY, MPI_INFO_NULL, &fh_C);
+  MPI_File_set_size(fh_C, MATRIX_FILE_HEADER + (MPI_Offset)m * n * sizeof(double));
+  if (my_id == 0) MPI_File_write_at(fh_C, 0, header, 3, MPI_INT64_T, MPI_STATUS_IGNORE);
+
+  if (ntiles > 0)	{	/* a process may own no rows when there are more processes than rows */
+    count = (int)(block_size < tile_size ? block_size : tile_size);
+    MPI_File_iread_at(fh_A, first, tile_A[0], count, MPI_DOUBLE, &read_req[0][0]);
+    MPI_File_iread_at(fh_B, first, tile_B[0], count, MPI_DOUBLE, &read_req[0][1]);
+  }
+
+  for(t = 0; t < ntiles; t++)	{
+    cur = t % 2;
+    offset = first + (MPI_Offset)t * tile_size * sizeof(double);
+    count = (int)((block_size - (MPI_Offset)t * tile_size < tile_size) ? block_size - (MPI_Offset)t * tile_size : tile_size);
+    MPI_Waitall(2, read_req[cur], MPI_STATUSES_IGNORE);
+
+    if (t+1 < ntiles)	{	/* prefetch the next tile into the other buffers */
+      next_count = (int)((block_size - (MPI_Offset)(t+1) * tile_size < tile_size) ? block_size - (MPI_Offset)(t+1) * tile_size : tile_size);
+      MPI_File_iread_at(fh_A, offset + (MPI_Offset)tile_size * sizeof(double), tile_A[1-cur], next_count, MPI_DOUBLE, &read_req[1-cur][0]);
+      MPI_File_iread_at(fh_B, offset + (MPI_Offset)tile_size * sizeof(double), tile_B[1-cur], next_count, MPI_DOUBLE, &read_req[1-cur][1]);
+    }
+
+    MPI_Wait(&write_req[cur], MPI_STATUS_IGNORE);	/* the write of tile t-2 used the same C buffer */
+    add_tile(tile_A[cur], tile_B[cur], tile_C[cur], count);
+    MPI_File_iwrite_at(fh_C, offset, tile_C[cur], count, MPI_DOUBLE, &write_req[cur]);
+  }
+
+  MPI_Waitall(2, write_req, MPI_STATUSES_IGNORE);
+  MPI_File_close(&fh_A);
+  MPI_File_close(&fh_B);
+  MPI_File_close(&fh_C);
+  time = MPI_Wtime() - start;
+
+  MPI_Reduce(&time, &max_time, 1, MPI_DOUBLE, MPI_MAX, 0, comm);
+  if (my_id == 0) printf("Out-of-core addition: %d tiles of %d elements per process, time = %lf, I/O throughput = %lf GB/s\n",
+			 ntiles, tile_size, max_time, 3.0 * m * (double)n * sizeof(double) / max_time * 1.0e-9);
+
+  for(t = 0; t < 2; t++)	{
+    free(tile_A[t]);
+    free(tile_B[t]);
+    free(tile_C[t]);
+  }
+  return;
+}
+
 int main(int argc, char *argv[])	{
 
   double *local_A, *local_B, *local_C;
-  int my_id, nprocs;
-  int m, local_m, n;
-  double start, end;
-  MPI_Status status;
+  int my_id, nprocs, provided;
+  int m, local_m, row_s, n;
+  double start, end, init_start, init_time;
+  const char *init_mode = "distributed";	/* distributed, file (MPI-IO), ooc (out-of-core) or scatter (root builds and scatters, reference path) */
+  const char *file_A = "A.mat", *file_B = "B.mat", *file_C = NULL;
+  int m_B, n_B;
+  int tile_size = 1 << 20;	/* elements per tile of the out-of-core mode (8 MB) */
+  const char *kernel_name = "auto";	/* naive (2D reference loop), auto, avx512, avx2 or scalar */
+  const char *op = "add";	/* add (C = A + B), axpby (C = alpha*A + beta*B) or inplace (A += B) */
+  const char *chosen_kernel = "naive";
+  double alpha = 1.0, beta = 1.0, gbs, stream_gbs = 0.0;
+  double *result;
+  int baseline = 0;
+  stream_kernel_t kernel = NULL;
+  bench_t bench;
+  bench_stats_t stats;
   MPI_Comm comm;
 
   m = 10240;			/* number of rows */
   n = 10240;			/* number of columns */
   
-  start = MPI_Wtime();
-  MPI_Init(&argc, &argv);
+  MPI_Init_thread(&argc, &argv, MPI_THREAD_FUNNELED, &provided);	/* only the master thread makes MPI calls */
+  start = MPI_Wtime();		/* the running time excludes MPI_Init and MPI_Finalize */
   comm = MPI_COMM_WORLD;
   MPI_Comm_size(comm, &nprocs);
   MPI_Comm_rank(comm, &my_id);
 
-  local_m = m / nprocs;		/* m > 0 and should be evenly divisible by nprocs */
-  allocate_memory(&local_A, &local_B, &local_C, local_m, n, comm);
-  populate_matrices(local_A, local_B, m, local_m, n, my_id, comm);
-  mat_add(local_A, local_B, local_C, m, local_m, n, my_id, comm);
+  for(int i = 1; i < argc-1; i++)	{
+    if (strcmp(argv[i], "-init") == 0)		init_mode = argv[++i];
+    else if (strcmp(argv[i], "-n") == 0)	m = n = atoi(argv[++i]);	/* square m = n matrices */
+    else if (strcmp(argv[i], "-a") == 0)	file_A = argv[++i];
+    else if (strcmp(argv[i], "-b") == 0)	file_B = argv[++i];
+    else if (strcmp(argv[i], "-o") == 0)	file_C = argv[++i];
+    else if (strcmp(argv[i], "-tile") == 0)	tile_size = atoi(argv[++i]);
+    else if (strcmp(argv[i], "-kernel") == 0)	kernel_name = argv[++i];
+    else if (strcmp(argv[i], "-op") == 0)	op = argv[++i];
+    else if (strcmp(argv[i], "-alpha") == 0)	alpha = atof(argv[++i]);
+    else if (strcmp(argv[i], "-beta") == 0)	beta = atof(argv[++i]);
+    else if (strcmp(argv[i], "-stream") == 0)	baseline = atoi(argv[++i]);	/* 1: measure the STREAM-style baseline */
+  }
+
+  init_start = MPI_Wtime();
+  if (strcmp(init_mode, "file") == 0 || strcmp(init_mode, "ooc") == 0)	{	/* the dimensions are taken from the file headers */
+    if (!read_matrix_header(file_A, &m, &n, comm) || !read_matrix_header(file_B, &m_B, &n_B, comm) || m != m_B || n != n_B)	{
+      if (my_id == 0) printf("\nCould not read matrices of the same size from '%s' and '%s'. Exiting!!\n", file_A, file_B);
+      MPI_Finalize();
+      return 0;
+    }
+  }
+  block_range(m, nprocs, my_id, &row_s, &local_m);	/* balanced row blocks, any m and process count */
+
+  if (strcmp(init_mode, "ooc") == 0)	{	/* A, B and C are never fully resident */
+    if (file_C == NULL || tile_size <= 0)	{
+      if (my_id == 0) printf("\nThe out-of-core mode needs an output file (-o) and a positive tile size. Exiting!!\n");
+    }
+    else
+      out_of_core_add(file_A, file_B, file_C, m, row_s, local_m, n, tile_size, my_id, comm);
+    MPI_Finalize();
+    return 0;
+  }
+
+  allocate_memory(&local_A, &local_B, &local_C, local_m, n);
+  if (strcmp(init_mode, "scatter") == 0)
+    populate_matrices(local_A, local_B, m, local_m, n, my_id, comm);
+  else if (strcmp(init_mode, "file") == 0)	{	/* every process reads its own row block */
+    read_matrix_block(file_A, local_A, m, n, row_s, local_m, 0, n, comm);
+    read_matrix_block(file_B, local_B, m, n, row_s, local_m, 0, n, comm);
+  }
+  else
+    populate_local_blocks(local_A, local_B, local_m, n);
+  init_time = MPI_Wtime() - init_start;
+  report_init_cost(init_time, init_mode, my_id, comm);
+  if (strcmp(op, "add") == 0) alpha = beta = 1.0;
+  if (strcmp(kernel_name, "naive") != 0) kernel = select_stream_kernel(kernel_name, &chosen_kernel);
+  else if (strcmp(op, "add") != 0)	{	/* the naive kernel is the original C = A + B loop */
+    if (my_id == 0) printf("\nThe naive kernel only computes C = A + B (-op add), use another kernel for -op %s. Exiting!!\n", op);
+    MPI_Finalize();
+    return 0;
+  }
+  result = (strcmp(op, "inplace") == 0) ? local_A : local_C;
+
+  /* best of the trials (-warmup, -trials); the in-place update is run once since it changes A */
+  bench_init(&bench, argc, argv, 1, 5);
+  if (strcmp(op, "inplace") == 0)	{
+    bench.warmup = 0;
+    bench.trials = 1;
+  }
+  while (bench_next(&bench, comm))	{
+    if (kernel == NULL)
+      mat_add(local_A, local_B, local_C, m, local_m, n, my_id, comm);
+    else if (strcmp(op, "inplace") == 0)
+      mat_add_fused(kernel, 1.0, local_A, 1.0, local_B, local_A, (long)local_m * n);
+    else
+      mat_add_fused(kernel, alpha, local_A, beta, local_B, local_C, (long)local_m * n);
+  }
+  stats = bench_report(&bench, "matrix_addition", kernel == NULL ? "naive" : chosen_kernel, n, comm);
+  gbs = 3.0 * sizeof(double) * m * (double)n / stats.min * 1.0e-9;	/* read A, read B, write C (or A) */
+  if (baseline) stream_gbs = stream_baseline((long)local_m * n, bench.trials, comm);
+  bench_free(&bench);
+  if (my_id == 0)	{
+    printf("Matrix addition (%s, kernel = %s): time = %lf, bandwidth = %lf GB/s", op, chosen_kernel, stats.min, gbs);
+    if (baseline) printf(", STREAM-style add baseline = %lf GB/s (%.1lf%%)", stream_gbs, 100.0 * gbs / stream_gbs);
+    printf("\n");
+  }
+
+  if (file_C != NULL)	/* every process writes its own row block of C */
+    write_matrix_block(file_C, result, m, n, row_s, local_m, 0, n, comm);
 	
   /* printing random element of the obtained matrix from each process */
-  /* as the values assigned were 5.0, the obtained matrix-C should be equal 10.0 */
-  printf("Sanity check printing local_C values: C[%d][%d] = %lf from process = %d\n", local_m/2, n/2, local_C[(local_m/2 * n) + (n/2)], my_id);
+  /* as the values assigned were 5.0, the obtained matrix-C should be equal 10.0 (alpha*5.0 + beta*5.0 for axpby) */
+  if (local_m > 0) printf("Sanity check printing local_C values: C[%d][%d] = %lf from process = %d\n", local_m/2, n/2, result[((size_t)local_m/2 * n) + (n/2)], my_id);
   
-  MPI_Finalize();
   end = MPI_Wtime();
+  MPI_Finalize();
 
-  if (my_id == 0) printf("\nProgram running time = %lf, processes used = %d\n", end-start, nprocs);
+  if (my_id == 0) printf("\nProgram running time = %lf, processes used = %d, threads per process = %d\n", end-start, nprocs, omp_get_max_threads());
   return 0;
 }
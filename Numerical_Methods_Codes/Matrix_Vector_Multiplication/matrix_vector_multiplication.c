@@ -1,15 +1,55 @@
 // MPI parallelized version of matrix(mxn) - vector(nx1) multiplication
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
 #include <time.h>
 #include <math.h>
 #include <mpi.h>
+#include <sys/resource.h>
+#include "../Common/block_decomposition.h"
+#include "../Common/benchmark.h"
+#ifdef _OPENMP
+#include <omp.h>
+#else
+#define omp_get_max_threads() 1
+#endif
+
+typedef struct	{		/* state kept alive across repeated matvecs on the same 1D layout */
+  double *local_x;		/* x segment of this process, bound to the gather */
+  double *global_x;		/* gather buffer for the full x */
+  int *counts, *displs;		/* x segment of every process (balanced blocks) */
+  int local_m, local_n, n;
+  MPI_Comm comm;
+  MPI_Request gather_req;	/* persistent allgather (MPI-4), MPI_REQUEST_NULL otherwise */
+} matvec_plan_t;
+
+typedef struct	{		/* compressed sparse row storage of a row block */
+  int nrows, nnz;
+  int *row_ptr;			/* nrows+1 offsets into col/val */
+  int *col;
+  double *val;
+} csr_t;
+
+typedef struct	{		/* neighbour plan of the distributed SpMV, built once from the column indices */
+  MPI_Comm graph_comm;		/* distributed graph: sources own x entries we need, destinations need ours */
+  int indegree, outdegree;
+  int *recvcounts, *rdispls;	/* per source, halo entries are sorted by global column */
+  int *sendcounts, *sdispls;	/* per destination */
+  int *send_idx;		/* local x indices packed for the destinations */
+  double *send_buf, *halo;
+  int nrecv, nsend;
+  csr_t diag;			/* columns owned by this process, local column indices */
+  csr_t offd;			/* remote columns, indices into halo */
+} spmv_plan_t;
 
 void read_dimensions(int *m_p, int* local_m_p, int* n_p, int* local_n_p, int my_id, int nprocs, MPI_Comm comm)	{
+  int start;
+
   if (my_id == 0)	{
-    printf("Enter number of rows:\n");		// m should be evenly divisible by nprocs and m > 0
+    printf("Enter number of rows:\n");		// m > 0
     scanf("%d", m_p);
-    printf("Enter number of columns:\n");	// n should be evenly divisible by nprocs and n > 0
+    printf("Enter number of columns:\n");	// n > 0
     scanf("%d", n_p);
     printf("\n");
   }
@@ -17,97 +57,862 @@ void read_dimensions(int *m_p, int* local_m_p, int* n_p, int* local_n_p, int my_
   MPI_Bcast(m_p, 1, MPI_INT, 0, comm);
   MPI_Bcast(n_p, 1, MPI_INT, 0, comm);
 
-  if (*m_p <= 0 || *n_p <= 0 || *m_p%nprocs != 0 || *n_p%nprocs != 0)	{ /* check for any errors */
+  if (*m_p <= 0 || *n_p <= 0)	{ /* check for any errors */
     if(my_id == 0) printf("\nPlease enter correct dimensions or number of MPI processes. Exiting!!\n");
     MPI_Finalize();
     exit(0);
   }
   
-  *local_m_p = *m_p / nprocs;
-  *local_n_p = *n_p / nprocs;
+  block_range(*m_p, nprocs, my_id, &start, local_m_p);
+  block_range(*n_p, nprocs, my_id, &start, local_n_p);
   return;
 }
 
-void allocate_memory(double **local_A_pp, double **local_x_pp, double **local_b_pp, int local_m, int n, int local_n, MPI_Comm comm)	{
-  *local_A_pp = malloc(local_m * n * sizeof(double));
-  *local_x_pp = malloc(local_n * sizeof(double));
-  *local_b_pp = malloc(local_m * sizeof(double));
+void allocate_memory(double **local_A_pp, double **local_x_pp, double **local_b_pp, int local_m, int n, int local_n)	{
+  *local_A_pp = malloc(((size_t)local_m * n + 1) * sizeof(double));
+  *local_x_pp = malloc((local_n + 1) * sizeof(double));
+  *local_b_pp = malloc((local_m + 1) * sizeof(double));
   return;
 }
 
+/* binary matrix file: a header of 3 int64 words (magic, rows, columns) followed by the rows x columns doubles in row-major order */
+#define MATRIX_FILE_MAGIC 0x314658495254414DLL	/* "MATRIXF1" in little-endian byte order */
+#define MATRIX_FILE_HEADER (3 * (MPI_Offset)sizeof(int64_t))
+
+/* collective: reads the dimensions stored in the header of a matrix file, returns 0 if the file can not be used */
+int read_matrix_header(const char *file_name, int *rows_p, int *cols_p, MPI_Comm comm)	{
+  MPI_File fh;
+  int64_t header[3];
+
+  if (MPI_File_open(comm, file_name, MPI_MODE_RDONLY, MPI_INFO_NULL, &fh) != MPI_SUCCESS) return 0;
+  MPI_File_read_at_all(fh, 0, header, 3, MPI_INT64_T, MPI_STATUS_IGNORE);
+  MPI_File_close(&fh);
+  if (header[0] != MATRIX_FILE_MAGIC || header[1] <= 0 || header[2] <= 0) return 0;
+
+  *rows_p = (int)header[1];
+  *cols_p = (int)header[2];
+  return 1;
+}
+
+/* file view selecting the rows x cols block at (row_s, col_s) of the global m x n matrix, returns the number of local elements */
+int set_block_view(MPI_File fh, int m, int n, int row_s, int rows, int col_s, int cols)	{
+  int sizes[2] = {m, n}, subsizes[2] = {rows, cols}, starts[2] = {row_s, col_s};
+  MPI_Datatype block_type;
+
+  if (rows <= 0 || cols <= 0)	{	/* empty block: the process still takes part in the collective call */
+    MPI_File_set_view(fh, MATRIX_FILE_HEADER, MPI_DOUBLE, MPI_DOUBLE, "native", MPI_INFO_NULL);
+    return 0;
+  }
+
+  MPI_Type_create_subarray(2, sizes, subsizes, starts, MPI_ORDER_C, MPI_DOUBLE, &block_type);
+  MPI_Type_commit(&block_type);
+  MPI_File_set_view(fh, MATRIX_FILE_HEADER, MPI_DOUBLE, block_type, "native", MPI_INFO_NULL);
+  MPI_Type_free(&block_type);
+  return rows * cols;
+}
+
+/* collective: every process reads its own block of the global m x n matrix directly from the file */
+void read_matrix_block(const char *file_name, double *local_M, int m, int n, int row_s, int rows, int col_s, int cols, MPI_Comm comm)	{
+  MPI_File fh;
+  int count;
+
+  MPI_File_open(comm, file_name, MPI_MODE_RDONLY, MPI_INFO_NULL, &fh);
+  count = set_block_view(fh, m, n, row_s, rows, col_s, cols);
+  MPI_File_read_at_all(fh, 0, local_M, count, MPI_DOUBLE, MPI_STATUS_IGNORE);
+  MPI_File_close(&fh);
+  return;
+}
+
+/* collective: every process writes its own block of the global m x n matrix, the root writes the header */
+void write_matrix_block(const char *file_name, double *local_M, int m, int n, int row_s, int rows, int col_s, int cols, MPI_Comm comm)	{
+  MPI_File fh;
+  int my_id, count;
+  int64_t header[3] = {MATRIX_FILE_MAGIC, m, n};
+
+  MPI_Comm_rank(comm, &my_id);
+  MPI_File_open(comm, file_name, MPI_MODE_CREATE | MPI_MODE_WRONLY, MPI_INFO_NULL, &fh);
+  MPI_File_set_size(fh, 0);
+  if (my_id == 0) MPI_File_write_at(fh, 0, header, 3, MPI_INT64_T, MPI_STATUS_IGNORE);
+  count = set_block_view(fh, m, n, row_s, rows, col_s, cols);
+  MPI_File_write_at_all(fh, 0, local_M, count, MPI_DOUBLE, MPI_STATUS_IGNORE);
+  MPI_File_close(&fh);
+  return;
+}
+
+/* distributed initialization: each process generates only its own row block of A and its segment of x */
+void populate_local_blocks(double *local_A, double *local_x, int local_m, int n, int local_n)	{
+  int i, j;
+
+#pragma omp parallel for private(j)
+  for(i = 0; i < local_m; i++)	
+    for(j = 0; j < n; j++)	
+      local_A[i*n+j] = 1.0;	/* for simplicity and sanity check, it is kept as 1.0 */
+  for(i = 0; i < local_n; i++)	local_x[i] = 1.0;
+  return;
+}
+
+/* reference initialization: the root builds the full m x n matrix and the vector and scatters them */
 void populate_matrices(double *local_A, double *local_x, int m, int local_m, int n, int local_n, int my_id, MPI_Comm comm)	{
   double* matA = NULL;
   double* vec = NULL;
-  int i, j;
-   
+  int i, j, nprocs;
+  int *counts_A = NULL, *displs_A = NULL, *counts_x = NULL, *displs_x = NULL;
+
+  MPI_Comm_size(comm, &nprocs);
   if(my_id == 0)	{
+    counts_A = malloc(nprocs * sizeof(int));
+    displs_A = malloc(nprocs * sizeof(int));
+    counts_x = malloc(nprocs * sizeof(int));
+    displs_x = malloc(nprocs * sizeof(int));
+    block_counts(m, nprocs, n, counts_A, displs_A);	/* row blocks of A */
+    block_counts(n, nprocs, 1, counts_x, displs_x);	/* segments of x */
     matA = malloc(m * n * sizeof(double));
     vec = malloc(n * sizeof(double));    
     for(i = 0; i < m; i++)	
       for(j = 0; j < n; j++)	
 	matA[i*n+j] = 1.0;	/* for simplicity and sanity check, it is kept as 1.0 */
     for(i = 0; i < n; i++)	vec[i] = 1.0;
-    MPI_Scatter(matA, local_m*n, MPI_DOUBLE, local_A, local_m*n, MPI_DOUBLE, 0, comm);
-    MPI_Scatter(vec, local_n, MPI_DOUBLE, local_x, local_n, MPI_DOUBLE, 0, comm);
-    free(matA);
-    free(vec);
   }
-  else	{
-    MPI_Scatter(NULL, local_m*n, MPI_DOUBLE, local_A, local_m*n, MPI_DOUBLE, 0, comm);
-    MPI_Scatter(NULL, local_n, MPI_DOUBLE, local_x, local_n, MPI_DOUBLE, 0, comm);
-  }   
+  MPI_Scatterv(matA, counts_A, displs_A, MPI_DOUBLE, local_A, local_m*n, MPI_DOUBLE, 0, comm);
+  MPI_Scatterv(vec, counts_x, displs_x, MPI_DOUBLE, local_x, local_n, MPI_DOUBLE, 0, comm);
+  free(matA);
+  free(vec);
+  free(counts_A);
+  free(displs_A);
+  free(counts_x);
+  free(displs_x);
   return;
 }
     
 void matvec_multiply(double* local_A, double* local_x, double* local_b, int local_m, int local_n, int n, MPI_Comm comm)	{
   double* global_x = NULL;
-  int i, j;
+  int i, j, nprocs, *counts, *displs;
 
+  MPI_Comm_size(comm, &nprocs);
   global_x = malloc(n * sizeof(double));
-  MPI_Allgather(local_x, local_n, MPI_DOUBLE, global_x, local_n, MPI_DOUBLE, comm);
+  counts = malloc(nprocs * sizeof(int));
+  displs = malloc(nprocs * sizeof(int));
+  block_counts(n, nprocs, 1, counts, displs);
+  MPI_Allgatherv(local_x, local_n, MPI_DOUBLE, global_x, counts, displs, MPI_DOUBLE, comm);
 
+#pragma omp parallel for private(j)
   for(i = 0; i < local_m; i++)	{
     local_b[i] = 0.0;
     for(j = 0; j < n; j++)	
-      local_b[i] += local_A[i*n+j] * global_x[j];
+      local_b[i] += local_A[(size_t)i*n+j] * global_x[j];
+  }
+
+  free(global_x);
+  free(counts);
+  free(displs);
+  return;
+}
+
+#define OVERLAP_CHUNK 64	/* rows of the diagonal block multiplied between progress polls */
+
+/* overlapped variant: the allgather of x is started non-blocking, the diagonal column block (own x segment) is */
+/* multiplied in row chunks while the master thread polls the request, and the off-diagonal columns are finished after */
+/* the wait. One parallel region covers both phases. MPI_Iallgatherv completes as a whole, so the off-diagonal blocks */
+/* cannot be used as they arrive */
+void matvec_multiply_overlap(double* local_A, double* local_x, double* local_b, int local_m, int local_n, int n, MPI_Comm comm)	{
+  double *global_x = NULL;
+  int my_id, nprocs, col_s, flag, *counts, *displs;
+  MPI_Request request;
+
+  MPI_Comm_rank(comm, &my_id);
+  MPI_Comm_size(comm, &nprocs);
+  global_x = malloc(n * sizeof(double));
+  counts = malloc(nprocs * sizeof(int));
+  displs = malloc(nprocs * sizeof(int));
+  block_counts(n, nprocs, 1, counts, displs);
+  col_s = displs[my_id];
+  MPI_Iallgatherv(local_x, local_n, MPI_DOUBLE, global_x, counts, displs, MPI_DOUBLE, comm, &request);
+
+#pragma omp parallel
+  {
+    int i, j;
+    double sum;
+
+    for(int i0 = 0; i0 < local_m; i0 += OVERLAP_CHUNK)	{
+      int i1 = (i0 + OVERLAP_CHUNK < local_m) ? i0 + OVERLAP_CHUNK : local_m;
+#pragma omp for nowait
+      for(i = i0; i < i1; i++)	{
+	sum = 0.0;
+	for(j = 0; j < local_n; j++)
+	  sum += local_A[(size_t)i*n+col_s+j] * local_x[j];
+	local_b[i] = sum;
+      }
+#pragma omp master
+      MPI_Test(&request, &flag, MPI_STATUS_IGNORE);	/* drives the progress of the collective (MPI_THREAD_FUNNELED) */
+    }
+
+#pragma omp master
+    MPI_Wait(&request, MPI_STATUS_IGNORE);
+#pragma omp barrier
+
+#pragma omp for
+    for(i = 0; i < local_m; i++)	{
+      sum = 0.0;
+      for(j = 0; j < col_s; j++)
+	sum += local_A[(size_t)i*n+j] * global_x[j];
+      for(j = col_s + local_n; j < n; j++)
+	sum += local_A[(size_t)i*n+j] * global_x[j];
+      local_b[i] += sum;
+    }
   }
 
   free(global_x);
+  free(counts);
+  free(displs);
+  return;
+}
+
+/* startup cost of the initialization: slowest process and largest peak resident memory (ru_maxrss is in kB on Linux) */
+void report_init_cost(double init_time, const char *init_mode, int my_id, MPI_Comm comm)	{
+  struct rusage usage;
+  double max_time, rss, max_rss;
+
+  getrusage(RUSAGE_SELF, &usage);
+  rss = usage.ru_maxrss / 1024.0;
+  MPI_Reduce(&init_time, &max_time, 1, MPI_DOUBLE, MPI_MAX, 0, comm);
+  MPI_Reduce(&rss, &max_rss, 1, MPI_DOUBLE, MPI_MAX, 0, comm);
+  if (my_id == 0) printf("Initialization (%s) time = %lf, peak RSS (max over processes) = %.1lf MB\n", init_mode, max_time, max_rss);
+  return;
+}
+
+/* setup of the iterative API: allocates the gather buffer once and, with MPI-4, creates a persistent allgather bound to local_x */
+void matvec_setup(matvec_plan_t *plan, double* local_x, int local_m, int local_n, int n, MPI_Comm comm)	{
+  plan->local_x = local_x;
+  int nprocs;
+
+  MPI_Comm_size(comm, &nprocs);
+  plan->global_x = malloc(n * sizeof(double));
+  plan->counts = malloc(nprocs * sizeof(int));
+  plan->displs = malloc(nprocs * sizeof(int));
+  block_counts(n, nprocs, 1, plan->counts, plan->displs);
+  plan->local_m = local_m;
+  plan->local_n = local_n;
+  plan->n = n;
+  plan->comm = comm;
+  plan->gather_req = MPI_REQUEST_NULL;
+#if MPI_VERSION >= 4
+  MPI_Allgatherv_init(local_x, local_n, MPI_DOUBLE, plan->global_x, plan->counts, plan->displs, MPI_DOUBLE, comm, MPI_INFO_NULL, &plan->gather_req);
+#endif
+  return;
+}
+
+/* b = A x with the current contents of plan->local_x, no allocation per call */
+void matvec_execute(matvec_plan_t *plan, double* local_A, double* local_b)	{
+  int i, j, n = plan->n;
+  double *global_x = plan->global_x;
+
+  if (plan->gather_req != MPI_REQUEST_NULL)	{
+    MPI_Start(&plan->gather_req);
+    MPI_Wait(&plan->gather_req, MPI_STATUS_IGNORE);
+  }
+  else
+    MPI_Allgatherv(plan->local_x, plan->local_n, MPI_DOUBLE, global_x, plan->counts, plan->displs, MPI_DOUBLE, plan->comm);
+
+#pragma omp parallel for private(j)
+  for(i = 0; i < plan->local_m; i++)	{
+    local_b[i] = 0.0;
+    for(j = 0; j < n; j++)
+      local_b[i] += local_A[(size_t)i*n+j] * global_x[j];
+  }
+  return;
+}
+
+void matvec_teardown(matvec_plan_t *plan)	{
+  if (plan->gather_req != MPI_REQUEST_NULL) MPI_Request_free(&plan->gather_req);
+  free(plan->global_x);
+  free(plan->counts);
+  free(plan->displs);
+  return;
+}
+
+/* power iteration x <- Ax/||Ax|| for a square A (local_m = local_n), returns the Rayleigh quotient x.Ax of the last step */
+/* the mean time per iteration is returned separately from the setup time */
+double power_iteration(double* local_A, double* local_x, double* local_b, int local_m, int local_n, int n, int iterations, MPI_Comm comm, double *setup_time_p, double *iter_time_p)	{
+  matvec_plan_t plan;
+  double t0, sums[2], global_sums[2], norm, lambda = 0.0;
+  int i, it;
+
+  t0 = MPI_Wtime();
+  matvec_setup(&plan, local_x, local_m, local_n, n, comm);
+  *setup_time_p = MPI_Wtime() - t0;
+
+  /* start from a unit vector */
+  sums[0] = 0.0;
+  for(i = 0; i < local_n; i++) sums[0] += local_x[i] * local_x[i];
+  MPI_Allreduce(sums, global_sums, 1, MPI_DOUBLE, MPI_SUM, comm);
+  for(i = 0; i < local_n; i++) local_x[i] /= sqrt(global_sums[0]);
+
+  MPI_Barrier(comm);
+  t0 = MPI_Wtime();
+  for(it = 0; it < iterations; it++)	{
+    matvec_execute(&plan, local_A, local_b);
+    sums[0] = sums[1] = 0.0;
+    for(i = 0; i < local_m; i++)	{
+      sums[0] += local_b[i] * local_b[i];	/* ||Ax||^2 */
+      sums[1] += local_x[i] * local_b[i];	/* x.Ax */
+    }
+    MPI_Allreduce(sums, global_sums, 2, MPI_DOUBLE, MPI_SUM, comm);
+    norm = sqrt(global_sums[0]);
+    lambda = global_sums[1];
+    for(i = 0; i < local_m; i++) local_x[i] = local_b[i] / norm;	/* written in place: the persistent gather reads local_x */
+  }
+  *iter_time_p = (MPI_Wtime() - t0) / iterations;
+
+  matvec_teardown(&plan);
+  return lambda;
+}
+
+/* 2D checkerboard matvec: process (i,j) holds block A_ij; the x segment j, held by process row 0, is broadcast down */
+/* process column j, every process multiplies its block and the partial products are summed along the process row onto column 0 */
+void matvec_multiply_2d(double* local_A, double* x_seg, double* partial_b, double* local_b, int m_i, int n_j, MPI_Comm row_comm, MPI_Comm col_comm)	{
+  int i, j;
+
+  MPI_Bcast(x_seg, n_j, MPI_DOUBLE, 0, col_comm);	/* rank in col_comm = row coordinate */
+
+#pragma omp parallel for private(j)
+  for(i = 0; i < m_i; i++)	{
+    partial_b[i] = 0.0;
+    for(j = 0; j < n_j; j++)
+      partial_b[i] += local_A[i*n_j+j] * x_seg[j];
+  }
+
+  MPI_Reduce(partial_b, local_b, m_i, MPI_DOUBLE, MPI_SUM, 0, row_comm);	/* rank in row_comm = column coordinate */
+  return;
+}
+
+#define RHS_ROWS 4	/* rows of A sharing each loaded row of X in the block kernel */
+#define RHS_COLS 8	/* right-hand sides per register block, X is zero-padded to a multiple of it */
+
+/* block matvec B = A X for k right-hand sides: X (n x k, row-major) is gathered in one collective and A is */
+/* streamed once per RHS_COLS vectors; a RHS_ROWS x RHS_COLS block of B is accumulated in registers */
+void matvec_multiply_block(double* local_A, double* local_X, double* local_B, int local_m, int local_n, int n, int k, MPI_Comm comm)	{
+  double *global_X = NULL, *X_padded = NULL;
+  int kp = (k + RHS_COLS - 1) / RHS_COLS * RHS_COLS;
+  int ib, r, rows, j, c, cb, nprocs, *counts, *displs;
+
+  MPI_Comm_size(comm, &nprocs);
+  global_X = malloc((size_t)n * k * sizeof(double));
+  X_padded = calloc((size_t)n * kp, sizeof(double));
+  counts = malloc(nprocs * sizeof(int));
+  displs = malloc(nprocs * sizeof(int));
+  block_counts(n, nprocs, k, counts, displs);	/* row blocks of X */
+  MPI_Allgatherv(local_X, local_n*k, MPI_DOUBLE, global_X, counts, displs, MPI_DOUBLE, comm);
+  for(j = 0; j < n; j++)
+    for(c = 0; c < k; c++) X_padded[(size_t)j*kp+c] = global_X[(size_t)j*k+c];
+
+#pragma omp parallel for collapse(2) private(r, rows, j, c)
+  for(ib = 0; ib < local_m; ib += RHS_ROWS)	{
+    for(cb = 0; cb < kp; cb += RHS_COLS)	{
+      double acc[RHS_ROWS][RHS_COLS] = {{0.0}};
+      rows = (ib + RHS_ROWS < local_m) ? RHS_ROWS : local_m - ib;
+      if (rows == RHS_ROWS)	{	/* fixed trip counts, kept in registers (simd over the columns, not over j) */
+	for(j = 0; j < n; j++)	{
+	  const double *x_row = &X_padded[(size_t)j*kp+cb];
+	  for(r = 0; r < RHS_ROWS; r++)	{
+	    const double a = local_A[(size_t)(ib+r)*n+j];
+#pragma omp simd
+	    for(c = 0; c < RHS_COLS; c++)
+	      acc[r][c] += a * x_row[c];
+	  }
+	}
+      }
+      else	{
+	for(j = 0; j < n; j++)	{
+	  const double *x_row = &X_padded[(size_t)j*kp+cb];
+	  for(r = 0; r < rows; r++)
+#pragma omp simd
+	    for(c = 0; c < RHS_COLS; c++)
+	      acc[r][c] += local_A[(size_t)(ib+r)*n+j] * x_row[c];
+	}
+      }
+      for(r = 0; r < rows; r++)
+	for(c = 0; c < RHS_COLS && cb + c < k; c++) local_B[(size_t)(ib+r)*k+cb+c] = acc[r][c];
+    }
+  }
+
+  free(global_X);
+  free(X_padded);
+  free(counts);
+  free(displs);
+  return;
+}
+
+/* times the block matvec against k separate matvecs on the same A and compares the results */
+void run_block_matvec(double* local_A, int local_m, int local_n, int n, int k, int ntrials, MPI_Comm comm)	{
+  double *local_X, *local_B, *x_col, *b_col, t0, time, time_block, time_single, err = 0.0, max_err;
+  int my_id, nprocs, col_s, size, i, c;
+
+  MPI_Comm_rank(comm, &my_id);
+  MPI_Comm_size(comm, &nprocs);
+  block_range(n, nprocs, my_id, &col_s, &size);
+  local_X = malloc(((size_t)local_n * k + 1) * sizeof(double));
+  local_B = malloc(((size_t)local_m * k + 1) * sizeof(double));
+  x_col = malloc((local_n + 1) * sizeof(double));
+  b_col = malloc((local_m + 1) * sizeof(double));
+  for(i = 0; i < local_n; i++)
+    for(c = 0; c < k; c++) local_X[(size_t)i*k+c] = 1.0 + c + (double)((col_s + i) % 7) / 7.0;
+
+  matvec_multiply_block(local_A, local_X, local_B, local_m, local_n, n, k, comm);	/* warm-up */
+  MPI_Barrier(comm);
+  t0 = MPI_Wtime();
+  for(int trial = 0; trial < ntrials; trial++)
+    matvec_multiply_block(local_A, local_X, local_B, local_m, local_n, n, k, comm);
+  time = (MPI_Wtime() - t0) / ntrials;
+  MPI_Reduce(&time, &time_block, 1, MPI_DOUBLE, MPI_MAX, 0, comm);
+
+  MPI_Barrier(comm);
+  t0 = MPI_Wtime();
+  for(int trial = 0; trial < ntrials; trial++)
+    for(c = 0; c < k; c++)	{
+      for(i = 0; i < local_n; i++) x_col[i] = local_X[(size_t)i*k+c];
+      matvec_multiply(local_A, x_col, b_col, local_m, local_n, n, comm);
+      if (trial == 0)
+	for(i = 0; i < local_m; i++) err = fmax(err, fabs(b_col[i] - local_B[(size_t)i*k+c]) / fmax(1.0, fabs(b_col[i])));
+    }
+  time = (MPI_Wtime() - t0) / ntrials;
+  MPI_Reduce(&time, &time_single, 1, MPI_DOUBLE, MPI_MAX, 0, comm);
+  MPI_Reduce(&err, &max_err, 1, MPI_DOUBLE, MPI_MAX, 0, comm);
+
+  if (my_id == 0)
+    printf("Block matvec with %d right-hand sides: time per call = %lf, %d single matvecs = %lf, speedup = %.2lf, max relative difference = %e\n",
+	   k, time_block, k, time_single, time_single / time_block, max_err);
+
+  free(local_X);
+  free(local_B);
+  free(x_col);
+  free(b_col);
+  return;
+}
+
+/* median time per call over the trials of the harness (after its warm-up calls), slowest process, on the root */
+double time_matvec_1d(double* local_A, double* local_x, double* local_b, int local_m, int local_n, int n, bench_t *bench, int overlap, MPI_Comm comm)	{
+  void (*multiply)(double*, double*, double*, int, int, int, MPI_Comm) = overlap ? matvec_multiply_overlap : matvec_multiply;
+
+  while (bench_next(bench, comm))
+    multiply(local_A, local_x, local_b, local_m, local_n, n, comm);
+  return bench_report(bench, "matrix_vector_multiplication", overlap ? "1d_overlap" : "1d", n, comm).median;
+}
+
+/* 2D layout on a pr x pc grid: sets up the blocks, runs the trials of the harness and returns the median time per call on the root */
+double run_matvec_2d(int m, int n, const char *init_mode, const char *file_A, const char *file_x, const char *file_b, bench_t *bench, MPI_Comm comm)	{
+  int nprocs, my_id, dims[2] = {0, 0}, periods[2] = {0, 0}, coords[2], remain_dims[2];
+  int row_s, m_i, col_s, n_j, i;
+  double *local_A, *x_seg, *partial_b, *local_b, max_time;
+  MPI_Comm grid_comm, row_comm, col_comm;
+
+  MPI_Comm_size(comm, &nprocs);
+  MPI_Dims_create(nprocs, 2, dims);
+  MPI_Cart_create(comm, 2, dims, periods, 1, &grid_comm);
+  MPI_Comm_rank(grid_comm, &my_id);
+  MPI_Cart_coords(grid_comm, my_id, 2, coords);
+  remain_dims[0] = 0; remain_dims[1] = 1;
+  MPI_Cart_sub(grid_comm, remain_dims, &row_comm);
+  remain_dims[0] = 1; remain_dims[1] = 0;
+  MPI_Cart_sub(grid_comm, remain_dims, &col_comm);
+
+  block_range(m, dims[0], coords[0], &row_s, &m_i);
+  block_range(n, dims[1], coords[1], &col_s, &n_j);
+  local_A = malloc(((size_t)m_i * n_j + 1) * sizeof(double));
+  x_seg = malloc((n_j + 1) * sizeof(double));
+  partial_b = malloc((m_i + 1) * sizeof(double));
+  local_b = malloc((m_i + 1) * sizeof(double));
+
+  if (strcmp(init_mode, "file") == 0)	{	/* every process reads its block of A, process row 0 reads the x segments */
+    read_matrix_block(file_A, local_A, m, n, row_s, m_i, col_s, n_j, grid_comm);
+    read_matrix_block(file_x, x_seg, n, 1, col_s, coords[0] == 0 ? n_j : 0, 0, 1, grid_comm);
+  }
+  else	{
+#pragma omp parallel for
+    for(i = 0; i < m_i*n_j; i++) local_A[i] = 1.0;	/* for simplicity and sanity check, it is kept as 1.0 */
+    for(i = 0; i < n_j; i++) x_seg[i] = 1.0;
+  }
+
+  while (bench_next(bench, grid_comm))
+    matvec_multiply_2d(local_A, x_seg, partial_b, local_b, m_i, n_j, row_comm, col_comm);
+  max_time = bench_report(bench, "matrix_vector_multiplication", "2d", n, grid_comm).median;
+
+  if (file_b != NULL)	/* process column 0 holds b */
+    write_matrix_block(file_b, local_b, m, 1, row_s, coords[1] == 0 ? m_i : 0, 0, 1, grid_comm);
+  if (coords[1] == 0 && m_i > 0)
+    printf("Sanity check printing local_b values: b[%d] = %lf from process (%d, %d)\n", m_i/2, local_b[m_i/2], coords[0], coords[1]);
+
+  MPI_Barrier(grid_comm);
+  if (my_id == 0) printf("2D matvec on a %d x %d grid: time per call = %lf, words communicated per process ~ %d\n", dims[0], dims[1], max_time, n_j + m_i);
+
+  free(local_A);
+  free(x_seg);
+  free(partial_b);
+  free(local_b);
+  MPI_Comm_free(&row_comm);
+  MPI_Comm_free(&col_comm);
+  MPI_Comm_free(&grid_comm);
+  return max_time;
+}
+
+void csr_allocate(csr_t *A, int nrows, int nnz)	{
+  A->nrows = nrows;
+  A->nnz = nnz;
+  A->row_ptr = malloc((nrows + 1) * sizeof(int));
+  A->col = malloc((nnz + 1) * sizeof(int));
+  A->val = malloc((nnz + 1) * sizeof(double));
+  return;
+}
+
+void csr_free(csr_t *A)	{
+  free(A->row_ptr);
+  free(A->col);
+  free(A->val);
+  return;
+}
+
+/* row block [row_s, row_s+rows) of a test matrix of order n, generated locally */
+/* laplace: 5-point Laplacian on a nx x nx grid (n = nx*nx), random: nnz_row entries per row at random columns */
+void generate_csr(csr_t *A, const char *matrix, int n, int nx, int nnz_row, int row_s, int rows)	{
+  int i, k, r, gi, gj, nnz = 0;
+  unsigned int seed;
+
+  csr_allocate(A, rows, rows * (strcmp(matrix, "laplace") == 0 ? 5 : nnz_row));
+  A->row_ptr[0] = 0;
+  for(i = 0; i < rows; i++)	{
+    r = row_s + i;
+    if (strcmp(matrix, "laplace") == 0)	{
+      gi = r / nx; gj = r % nx;
+      if (gi > 0)	{ A->col[nnz] = r - nx; A->val[nnz++] = -1.0; }
+      if (gj > 0)	{ A->col[nnz] = r - 1;  A->val[nnz++] = -1.0; }
+      A->col[nnz] = r; A->val[nnz++] = 4.0;
+      if (gj < nx-1)	{ A->col[nnz] = r + 1;  A->val[nnz++] = -1.0; }
+      if (gi < nx-1)	{ A->col[nnz] = r + nx; A->val[nnz++] = -1.0; }
+    }
+    else	{
+      seed = 2654435761u * (unsigned int)(r + 1);	/* same matrix for any process count */
+      for(k = 0; k < nnz_row; k++)	{
+	seed = seed * 1103515245u + 12345u;
+	A->col[nnz] = (int)((seed >> 8) % (unsigned int)n);
+	A->val[nnz++] = 1.0 + (double)(seed % 100) / 100.0;
+      }
+    }
+    A->row_ptr[i+1] = nnz;
+  }
+  A->nnz = nnz;
+  return;
+}
+
+int compare_int(const void *a, const void *b)	{
+  return (*(const int *)a > *(const int *)b) - (*(const int *)a < *(const int *)b);
+}
+
+/* analyzes the column indices of the local rows once: splits A into the diagonal and off-diagonal blocks, */
+/* finds the remote x entries needed and their owners, tells every owner which of its entries to send, */
+/* and creates the distributed graph communicator used by the neighbourhood exchange */
+void spmv_setup(spmv_plan_t *plan, csr_t *A, int n, int row_s, int rows, MPI_Comm comm)	{
+  int nprocs, i, k, c, h, q, nremote = 0;
+  int *remote, *halo_pos, *need_counts, *give_counts, *need_displs, *give_displs, *give_cols, *sources, *dests, *weights;
+
+  MPI_Comm_size(comm, &nprocs);
+
+  /* sorted unique remote columns, grouped by owner since the owners are monotonic in the column index */
+  remote = malloc((A->nnz + 1) * sizeof(int));
+  for(k = 0; k < A->nnz; k++)
+    if (A->col[k] < row_s || A->col[k] >= row_s + rows) remote[nremote++] = A->col[k];
+  qsort(remote, nremote, sizeof(int), compare_int);
+  for(i = 0, h = 0; i < nremote; i++)
+    if (h == 0 || remote[i] != remote[h-1]) remote[h++] = remote[i];
+  nremote = h;
+
+  /* split into diag (local column index) and offd (halo index found by bisection) */
+  csr_allocate(&plan->diag, rows, A->nnz);
+  csr_allocate(&plan->offd, rows, A->nnz);
+  plan->diag.row_ptr[0] = plan->offd.row_ptr[0] = 0;
+  plan->diag.nnz = plan->offd.nnz = 0;
+  for(i = 0; i < rows; i++)	{
+    for(k = A->row_ptr[i]; k < A->row_ptr[i+1]; k++)	{
+      c = A->col[k];
+      if (c >= row_s && c < row_s + rows)	{
+	plan->diag.col[plan->diag.nnz] = c - row_s;
+	plan->diag.val[plan->diag.nnz++] = A->val[k];
+      }
+      else	{
+	halo_pos = bsearch(&c, remote, nremote, sizeof(int), compare_int);
+	plan->offd.col[plan->offd.nnz] = (int)(halo_pos - remote);
+	plan->offd.val[plan->offd.nnz++] = A->val[k];
+      }
+    }
+    plan->diag.row_ptr[i+1] = plan->diag.nnz;
+    plan->offd.row_ptr[i+1] = plan->offd.nnz;
+  }
+
+  /* one-time exchange of the request lists with every process */
+  need_counts = calloc(nprocs, sizeof(int));
+  give_counts = malloc(nprocs * sizeof(int));
+  need_displs = malloc(nprocs * sizeof(int));
+  give_displs = malloc(nprocs * sizeof(int));
+  for(i = 0; i < nremote; i++) need_counts[block_owner(n, nprocs, remote[i])]++;
+  MPI_Alltoall(need_counts, 1, MPI_INT, give_counts, 1, MPI_INT, comm);
+  need_displs[0] = give_displs[0] = 0;
+  for(q = 1; q < nprocs; q++)	{
+    need_displs[q] = need_displs[q-1] + need_counts[q-1];
+    give_displs[q] = give_displs[q-1] + give_counts[q-1];
+  }
+  plan->nrecv = nremote;
+  plan->nsend = give_displs[nprocs-1] + give_counts[nprocs-1];
+  give_cols = malloc((plan->nsend + 1) * sizeof(int));
+  MPI_Alltoallv(remote, need_counts, need_displs, MPI_INT, give_cols, give_counts, give_displs, MPI_INT, comm);
+
+  /* keep only the actual neighbours, in rank order on both sides */
+  plan->indegree = plan->outdegree = 0;
+  for(q = 0; q < nprocs; q++)	{
+    if (need_counts[q] > 0) plan->indegree++;
+    if (give_counts[q] > 0) plan->outdegree++;
+  }
+  sources = malloc((plan->indegree + 1) * sizeof(int));
+  dests = malloc((plan->outdegree + 1) * sizeof(int));
+  plan->recvcounts = malloc((plan->indegree + 1) * sizeof(int));
+  plan->rdispls = malloc((plan->indegree + 1) * sizeof(int));
+  plan->sendcounts = malloc((plan->outdegree + 1) * sizeof(int));
+  plan->sdispls = malloc((plan->outdegree + 1) * sizeof(int));
+  for(q = 0, i = 0, k = 0; q < nprocs; q++)	{
+    if (need_counts[q] > 0)	{
+      sources[i] = q; plan->recvcounts[i] = need_counts[q]; plan->rdispls[i++] = need_displs[q];
+    }
+    if (give_counts[q] > 0)	{
+      dests[k] = q; plan->sendcounts[k] = give_counts[q]; plan->sdispls[k++] = give_displs[q];
+    }
+  }
+  /* unit weights in real buffers (at least one element) rather than the MPI_UNWEIGHTED sentinel pointer, which the */
+  /* compiler flags as a read from a region of size 0 */
+  weights = malloc((plan->indegree + plan->outdegree + 1) * sizeof(int));
+  for(i = 0; i < plan->indegree + plan->outdegree + 1; i++) weights[i] = 1;
+  MPI_Dist_graph_create_adjacent(comm, plan->indegree, sources, weights, plan->outdegree, dests, weights,
+				 MPI_INFO_NULL, 0, &plan->graph_comm);
+
+  plan->send_idx = malloc((plan->nsend + 1) * sizeof(int));
+  for(i = 0; i < plan->nsend; i++) plan->send_idx[i] = give_cols[i] - row_s;
+  plan->send_buf = malloc((plan->nsend + 1) * sizeof(double));
+  plan->halo = malloc((plan->nrecv + 1) * sizeof(double));
+
+  free(remote); free(need_counts); free(give_counts); free(need_displs); free(give_displs);
+  free(give_cols); free(sources); free(dests); free(weights);
+  return;
+}
+
+void spmv_teardown(spmv_plan_t *plan)	{
+  MPI_Comm_free(&plan->graph_comm);
+  free(plan->recvcounts); free(plan->rdispls); free(plan->sendcounts); free(plan->sdispls);
+  free(plan->send_idx); free(plan->send_buf); free(plan->halo);
+  csr_free(&plan->diag);
+  csr_free(&plan->offd);
+  return;
+}
+
+/* b = A x: the halo exchange runs while the diagonal block is multiplied against local_x, */
+/* the off-diagonal block is added once the remote entries have arrived */
+void spmv_multiply(spmv_plan_t *plan, double* local_x, double* local_b)	{
+  int i, k;
+  MPI_Request request;
+
+  for(i = 0; i < plan->nsend; i++) plan->send_buf[i] = local_x[plan->send_idx[i]];
+  MPI_Ineighbor_alltoallv(plan->send_buf, plan->sendcounts, plan->sdispls, MPI_DOUBLE,
+			  plan->halo, plan->recvcounts, plan->rdispls, MPI_DOUBLE, plan->graph_comm, &request);
+
+#pragma omp parallel for private(k)
+  for(i = 0; i < plan->diag.nrows; i++)	{
+    local_b[i] = 0.0;
+    for(k = plan->diag.row_ptr[i]; k < plan->diag.row_ptr[i+1]; k++)
+      local_b[i] += plan->diag.val[k] * local_x[plan->diag.col[k]];
+  }
+
+  MPI_Wait(&request, MPI_STATUS_IGNORE);
+
+#pragma omp parallel for private(k)
+  for(i = 0; i < plan->offd.nrows; i++)
+    for(k = plan->offd.row_ptr[i]; k < plan->offd.row_ptr[i+1]; k++)
+      local_b[i] += plan->offd.val[k] * plan->halo[plan->offd.col[k]];
+  return;
+}
+
+/* CSR path: generates the row block, builds the plan, times the SpMV trials of the harness and checks b against a product with the gathered x */
+void run_spmv(const char *matrix, int nx, int nnz_row, bench_t *bench, MPI_Comm comm)	{
+  int nprocs, my_id, n, row_s, rows, i, k, q, *counts, *displs;
+  long long nnz, nnz_total, halo_total, halo_max, halo;
+  double *local_x, *local_b, *global_x, t0, setup_time, time, max_time, err, max_err;
+  csr_t A;
+  spmv_plan_t plan;
+
+  MPI_Comm_size(comm, &nprocs);
+  MPI_Comm_rank(comm, &my_id);
+  n = (strcmp(matrix, "laplace") == 0) ? nx * nx : nx;
+  block_range(n, nprocs, my_id, &row_s, &rows);
+
+  generate_csr(&A, matrix, n, nx, nnz_row, row_s, rows);
+  local_x = malloc((rows + 1) * sizeof(double));
+  local_b = malloc((rows + 1) * sizeof(double));
+  for(i = 0; i < rows; i++) local_x[i] = 1.0 + (double)((row_s + i) % 10) / 10.0;
+
+  MPI_Barrier(comm);
+  t0 = MPI_Wtime();
+  spmv_setup(&plan, &A, n, row_s, rows, comm);
+  time = MPI_Wtime() - t0;
+  MPI_Reduce(&time, &setup_time, 1, MPI_DOUBLE, MPI_MAX, 0, comm);
+
+  while (bench_next(bench, comm))
+    spmv_multiply(&plan, local_x, local_b);
+  max_time = bench_report(bench, "matrix_vector_multiplication", matrix, n, comm).median;
+
+  /* check against the full product with an allgathered x */
+  counts = malloc(nprocs * sizeof(int));
+  displs = malloc(nprocs * sizeof(int));
+  for(q = 0; q < nprocs; q++) block_range(n, nprocs, q, &displs[q], &counts[q]);
+  global_x = malloc(n * sizeof(double));
+  MPI_Allgatherv(local_x, rows, MPI_DOUBLE, global_x, counts, displs, MPI_DOUBLE, comm);
+  err = 0.0;
+  for(i = 0; i < rows; i++)	{
+    t0 = 0.0;
+    for(k = A.row_ptr[i]; k < A.row_ptr[i+1]; k++) t0 += A.val[k] * global_x[A.col[k]];
+    err = fmax(err, fabs(t0 - local_b[i]));
+  }
+  MPI_Reduce(&err, &max_err, 1, MPI_DOUBLE, MPI_MAX, 0, comm);
+
+  nnz = A.nnz;
+  halo = plan.nrecv;
+  MPI_Reduce(&nnz, &nnz_total, 1, MPI_LONG_LONG, MPI_SUM, 0, comm);
+  MPI_Reduce(&halo, &halo_total, 1, MPI_LONG_LONG, MPI_SUM, 0, comm);
+  MPI_Reduce(&halo, &halo_max, 1, MPI_LONG_LONG, MPI_MAX, 0, comm);
+  if (my_id == 0)	{
+    printf("CSR SpMV (%s, n = %d, nnz = %lld) on %d processes: setup time = %lf, time per call = %lf, max error = %e\n",
+	   matrix, n, nnz_total, nprocs, setup_time, max_time, max_err);
+    printf("x entries received per process: mean = %.1lf, max = %lld (a full allgather receives %d), CSR storage = %.1lf MB vs dense %.1lf MB\n",
+	   (double)halo_total / nprocs, halo_max, n - n / nprocs,
+	   nnz_total * (sizeof(double) + sizeof(int)) / 1.0e6, (double)n * n * sizeof(double) / 1.0e6);
+  }
+
+  spmv_teardown(&plan);
+  csr_free(&A);
+  free(local_x); free(local_b); free(global_x); free(counts); free(displs);
   return;
 }
 
 int main(int argc, char *argv[])	{
 
   double *local_A, *local_x, *local_b;
-  int my_id, nprocs;
-  int m, local_m, n, local_n;
-  double start, end;
-  MPI_Status status;
+  int my_id, nprocs, provided;
+  int m, local_m, n, local_n, row_s, col_s;
+  double start, end, init_start, init_time;
+  const char *init_mode = "distributed";	/* distributed, file (MPI-IO) or scatter (root builds and scatters, reference path) */
+  const char *file_A = "A.mat", *file_x = "x.mat", *file_b = NULL;
+  const char *layout = "1d";	/* 1d (row blocks), 2d (checkerboard) or compare (both) */
+  const char *format = "dense", *matrix = "laplace";	/* csr: sparse test matrix, laplace (nx*nx unknowns) or random (nx unknowns) */
+  int nx = 1024, nnz_row = 16;
+  int nrhs = 0;			/* > 0: block matvec with nrhs right-hand sides */
+  int overlap = 0;		/* 1: Iallgather overlapped with the diagonal block */
+  int n_x, one, ntrials, iterations = 0;
+  double lambda, setup_time, iter_time;
+  double time_1d = 0.0, time_2d = 0.0;
+  bench_t bench;
   MPI_Comm comm;
 
   m = 10240;			/* number of rows */
   n = 10240;			/* number of columns */
   
-  start = MPI_Wtime();
-  MPI_Init(&argc, &argv);
+  MPI_Init_thread(&argc, &argv, MPI_THREAD_FUNNELED, &provided);	/* only the master thread makes MPI calls */
+  start = MPI_Wtime();		/* the running time excludes MPI_Init and MPI_Finalize */
   comm = MPI_COMM_WORLD;
   MPI_Comm_size(comm, &nprocs);
   MPI_Comm_rank(comm, &my_id);
 
-  local_m = m / nprocs;		/* m > 0 and should be evenly divisible by nprocs */
-  local_n = n / nprocs;		/* n > 0 and should be evenly divisible by nprocs */
+  for(int i = 1; i < argc-1; i++)	{
+    if (strcmp(argv[i], "-init") == 0)		init_mode = argv[++i];
+    else if (strcmp(argv[i], "-n") == 0)	m = n = atoi(argv[++i]);	/* square m = n matrix */
+    else if (strcmp(argv[i], "-a") == 0)	file_A = argv[++i];
+    else if (strcmp(argv[i], "-x") == 0)	file_x = argv[++i];
+    else if (strcmp(argv[i], "-o") == 0)	file_b = argv[++i];
+    else if (strcmp(argv[i], "-layout") == 0)	layout = argv[++i];
+    else if (strcmp(argv[i], "-iterate") == 0)	iterations = atoi(argv[++i]);	/* power iterations, square A only */
+    else if (strcmp(argv[i], "-nrhs") == 0)	nrhs = atoi(argv[++i]);
+    else if (strcmp(argv[i], "-overlap") == 0)	overlap = atoi(argv[++i]);
+    else if (strcmp(argv[i], "-format") == 0)	format = argv[++i];
+    else if (strcmp(argv[i], "-matrix") == 0)	matrix = argv[++i];
+    else if (strcmp(argv[i], "-nx") == 0)	nx = atoi(argv[++i]);
+    else if (strcmp(argv[i], "-nnz") == 0)	nnz_row = atoi(argv[++i]);
+  }
+  bench_init(&bench, argc, argv, 1, 10);	/* -warmup, -trials, -bench, -bench-out */
+  ntrials = bench.trials;
+
+  if (strcmp(format, "csr") == 0)	{	/* sparse path, any process count */
+    run_spmv(matrix, nx, nnz_row, &bench, comm);
+    MPI_Finalize();
+    return 0;
+  }
+
+  init_start = MPI_Wtime();
+  if (strcmp(init_mode, "file") == 0)	{	/* the dimensions are taken from the file headers, x is stored as a n x 1 matrix */
+    if (!read_matrix_header(file_A, &m, &n, comm) || !read_matrix_header(file_x, &n_x, &one, comm) || n_x != n || one != 1)	{
+      if (my_id == 0) printf("\nCould not read a m x n matrix from '%s' and a n x 1 vector from '%s'. Exiting!!\n", file_A, file_x);
+      MPI_Finalize();
+      return 0;
+    }
+  }
+  if (strcmp(layout, "1d") != 0)	{	/* the 2D layout handles any m, n and process count */
+    time_2d = run_matvec_2d(m, n, init_mode, file_A, file_x, file_b, &bench, comm);
+    if (strcmp(layout, "2d") == 0)	{
+      MPI_Finalize();
+      return 0;
+    }
+    file_b = NULL;
+  }
+
   // read_dimensions(&m, &local_m, &n, &local_n, my_id, nprocs, comm);   // user can uncomment this procedure if wish to
-  allocate_memory(&local_A, &local_x, &local_b, local_m, n, local_n, comm);
-  populate_matrices(local_A, local_x, m, local_m, n, local_n, my_id, comm);
-  matvec_multiply(local_A, local_x, local_b, local_m, local_n, n, comm);
+  block_range(m, nprocs, my_id, &row_s, &local_m);	/* balanced row blocks of A and b, any m and process count */
+  block_range(n, nprocs, my_id, &col_s, &local_n);	/* balanced segments of x */
+
+  allocate_memory(&local_A, &local_x, &local_b, local_m, n, local_n);
+  if (strcmp(init_mode, "scatter") == 0)
+    populate_matrices(local_A, local_x, m, local_m, n, local_n, my_id, comm);
+  else if (strcmp(init_mode, "file") == 0)	{	/* every process reads its own row block of A and segment of x */
+    read_matrix_block(file_A, local_A, m, n, row_s, local_m, 0, n, comm);
+    read_matrix_block(file_x, local_x, n, 1, col_s, local_n, 0, 1, comm);
+  }
+  else
+    populate_local_blocks(local_A, local_x, local_m, n, local_n);
+  init_time = MPI_Wtime() - init_start;
+  report_init_cost(init_time, init_mode, my_id, comm);
+  if (iterations > 0)	{
+    if (m != n)	{
+      if (my_id == 0) printf("\nThe power iteration needs a square matrix. Exiting!!\n");
+      MPI_Finalize();
+      return 0;
+    }
+    lambda = power_iteration(local_A, local_x, local_b, local_m, local_n, n, iterations, comm, &setup_time, &iter_time);
+    if (my_id == 0) printf("Power iteration: %d iterations, dominant eigenvalue estimate = %lf, setup time = %lf, time per iteration = %lf (%s allgather)\n",
+			   iterations, lambda, setup_time, iter_time, MPI_VERSION >= 4 ? "persistent" : "blocking");
+    MPI_Finalize();
+    return 0;
+  }
+
+  if (nrhs > 0)	{
+    run_block_matvec(local_A, local_m, local_n, n, nrhs, ntrials, comm);
+    MPI_Finalize();
+    return 0;
+  }
+
+  time_1d = time_matvec_1d(local_A, local_x, local_b, local_m, local_n, n, &bench, overlap, comm);
+  if (my_id == 0) printf("1D matvec%s on %d processes: time per call = %lf, words communicated per process ~ %d\n", overlap ? " (overlapped)" : "", nprocs, time_1d, n - local_n);
+  if (my_id == 0 && strcmp(layout, "compare") == 0) printf("2D / 1D time per call = %lf\n", time_2d / time_1d);
+  if (file_b != NULL)	/* every process writes its own segment of b */
+    write_matrix_block(file_b, local_b, m, 1, row_s, local_m, 0, 1, comm);
 	
   /* printing random element of the obtained vector from each process*/
   /* as the values assigned were 1.0, the obtained vector-b should be equal to #columns, i.e., n */
-  printf("Sanity check printing local_b values: b[%d] = %lf from process = %d\n", local_m/2, local_b[local_m/2], my_id);
+  if (local_m > 0) printf("Sanity check printing local_b values: b[%d] = %lf from process = %d\n", local_m/2, local_b[local_m/2], my_id);
   
-  MPI_Finalize();
+  bench_free(&bench);
   end = MPI_Wtime();
+  MPI_Finalize();
 
-  if (my_id == 0) printf("\nProgram running time = %lf, processes used = %d\n", end-start, nprocs);
+  if (my_id == 0) printf("\nProgram running time = %lf, processes used = %d, threads per process = %d\n", end-start, nprocs, omp_get_max_threads());
   return 0;
 }
@@ -1,123 +1,137 @@
-// MPI parallelized version to compute first derivative using explicit 2nd order central difference scheme
+// MPI parallelized version to compute first (or second) derivative using explicit central difference schemes of order 2 to 8,
+// or compact (Pade) schemes of order 4 to 8 (Common/fd_stencil.h)
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
 #include <time.h>
 #include <math.h>
 #include <mpi.h>
+#include "../Common/block_decomposition.h"
+#include "../Common/benchmark.h"
+#include "../Common/fd_stencil.h"
+#ifdef _OPENMP
+#include <omp.h>
+#else
+#define omp_get_max_threads() 1
+#endif
 
 int main(int argc, char *argv[])	{
 
-  int my_id, nprocs;
-  MPI_Status status;
+  int my_id, nprocs, provided;
 
-  int i, nx, local_n, local_xs, local_xe;
+  int i, nx, local_n, local_xs;
+  int *counts = NULL, *displs = NULL;
+  int order = 2, deriv = 1, compact = 0;	/* -order 2|4|6|8, -deriv 1|2, -scheme explicit|compact */
 
   double dx = 0.001;		/* set the delta-x */
   double xmin = -1.0;
   double xmax = 1.0;
-  double U_left_bound = 0.0;
-  double U_right_bound = 0.0;
-  double x, temp;
-  double *local_U, *local_dU;
+  double x, exact, error, max_error = 0.0, interior_error = 0.0;
+  double *local_U, *local_dU, *local_rhs = NULL;
   double *global_dU = NULL;
-  double start_time, end_time;
+  char variant[32], file_name[64];
   FILE *fptr;
+  fd_stencil_t st;
+  fd_compact_t cs;
+  bench_t bench;
 
-  MPI_Init(&argc, &argv);
+  MPI_Init_thread(&argc, &argv, MPI_THREAD_FUNNELED, &provided);	/* only the master thread makes MPI calls */
   MPI_Comm_rank(MPI_COMM_WORLD, &my_id);
   MPI_Comm_size(MPI_COMM_WORLD, &nprocs);
 
-  start_time = MPI_Wtime();
-  nx = (int)((xmax - xmin) / dx);
-  local_n = nx / nprocs;
-
-  /* assigning local start/end points for each process */
-  if (my_id != nprocs-1)	{ 
-    local_xs = my_id * local_n;
-    local_xe = local_xs + local_n - 1;
+  nx = (int)((xmax - xmin) / dx + 0.5);
+  for(i = 1; i < argc-1; i++)	{
+    if (strcmp(argv[i], "-nx") == 0)	{	/* number of grid intervals, overrides the default delta-x */
+      nx = atoi(argv[++i]);
+      dx = (xmax - xmin) / nx;
+    }
+    else if (strcmp(argv[i], "-order") == 0) order = atoi(argv[++i]);
+    else if (strcmp(argv[i], "-deriv") == 0) deriv = atoi(argv[++i]);
+    else if (strcmp(argv[i], "-scheme") == 0) compact = (strcmp(argv[++i], "compact") == 0);
   }
-  else	{
-    local_xs = my_id * local_n;
-    local_xe = local_xs + local_n;
+  if (fd_stencil_init(&st, deriv, order, compact, dx) != 0)	{
+    if (my_id == 0) printf("\nUnsupported scheme: derivative %d of order %d (explicit: 2, 4, 6, 8; compact: 4, 6, 8). Exiting!!\n", deriv, order);
+    MPI_Finalize();
+    return 0;
   }
 
-  /* allocate memory */
-  local_U = calloc(local_n+2, sizeof(double));
-  local_dU = calloc(local_n+2, sizeof(double));
-
-  /* calculate local-U_i before calculating derivatives */
-  for(i = 1; i < local_n+1; i++)	{
-    x = xmin + local_xs * dx + (i - 1) * dx;
-    local_U[i] = x * tan(x);
+  /* the nx+1 grid points (boundaries included) are split into balanced blocks, local points are stored after st.radius ghost points */
+  block_range(nx+1, nprocs, my_id, &local_xs, &local_n);
+  if ((nx+1) / nprocs < fd_min_local_points(&st))	{	/* whole ghost layers and one-sided boundary stencils */
+    if (my_id == 0) printf("\nToo many processes (%d) for %d grid points. Exiting!!\n", nprocs, nx+1);
+    MPI_Finalize();
+    return 0;
   }
 
-  if (my_id == nprocs-1)
-    local_U[local_n+1] = 1.0 * tan(1.0);
-
-  /* NOTE: since 2nd order CDS is implemented, it will require only one ghost point to store the boundary U value */
-  /* communicating to left neighbour */
-  if (my_id != 0)	
-    MPI_Send(&local_U[1], 1, MPI_DOUBLE, my_id-1, 100, MPI_COMM_WORLD);
-  if (my_id != nprocs-1)	{	
-    MPI_Recv(&U_right_bound, 1, MPI_DOUBLE, my_id+1, 100, MPI_COMM_WORLD, &status);
-    local_U[local_n+1] = U_right_bound;
+  /* allocate memory */
+  local_U = calloc(local_n + 2*st.radius, sizeof(double));
+  local_dU = calloc(local_n, sizeof(double));
+  if (compact)	{
+    local_rhs = calloc(local_n, sizeof(double));
+    fd_compact_init(&cs, &st, local_n, local_xs, nx);
   }
-
-  /* communicating to right neighbour */
-  if (my_id != nprocs-1)	
-    MPI_Send(&local_U[local_n], 1, MPI_DOUBLE, my_id+1, 200, MPI_COMM_WORLD);
-  if (my_id != 0)	{
-    MPI_Recv(&U_left_bound, 1, MPI_DOUBLE, my_id-1, 200, MPI_COMM_WORLD, &status);
-    local_U[0] = U_left_bound;
+  if (my_id == 0)	{
+    global_dU = calloc(nx+1, sizeof(double));
+    counts = malloc(nprocs * sizeof(int));
+    displs = malloc(nprocs * sizeof(int));
+    block_counts(nx+1, nprocs, 1, counts, displs);
   }
 
-  /* calculating first derivatives in each process */
-  for(i = 1; i < local_n+1; i++)	{
-    if ((my_id == 0) && (i == 1))	{
-      local_dU[i] = (-3.0 * local_U[i] + 4.0 * local_U[i+1] - local_U[i+2]) / (2.0 * dx);
-    }
-    else	{
-      local_dU[i] = (local_U[i+1] - local_U[i-1]) / (2.0 * dx);
+  bench_init(&bench, argc, argv, 1, 10);	/* warm-up runs and timed trials of the evaluation, exchange, derivative and gather */
+  while (bench_next(&bench, MPI_COMM_WORLD))	{
+    /* calculate local-U_i before calculating derivatives */
+#pragma omp parallel for private(x)
+    for(i = 0; i < local_n; i++)	{
+      x = xmin + (local_xs + i) * dx;
+      local_U[st.radius+i] = x * tan(x);
     }
-  }
 
-  if (my_id == nprocs-1)
-    local_dU[local_n+1] = (3.0 * local_U[local_n+1] - 4.0 * local_U[local_n] + local_U[local_n-1]) / (2.0 * dx);
+    /* the ghost layer is as wide as the stencil radius: st.radius values from each neighbour */
+    fd_exchange_halo(&st, local_U, local_n, MPI_COMM_WORLD);
 
-  /* gathering locally computed first derivatives from each process into root process */
-  if (my_id == 0)	{
-    global_dU = calloc(nx+1, sizeof(double));
-    MPI_Gather(&local_dU[1], local_n, MPI_DOUBLE, global_dU, local_n, MPI_DOUBLE, 0, MPI_COMM_WORLD);
-  }
-  else	{
-    MPI_Gather(&local_dU[1], local_n, MPI_DOUBLE, NULL, local_n, MPI_DOUBLE, 0, MPI_COMM_WORLD);
-  }
+    /* calculating derivatives in each process, one-sided stencils of the same order within st.radius of the boundaries */
+    if (compact)	{
+      fd_apply(&st, local_U, local_rhs, local_n, local_xs, nx);
+      fd_compact_solve(&cs, local_rhs, local_dU, MPI_COMM_WORLD);
+    }
+    else fd_apply(&st, local_U, local_dU, local_n, local_xs, nx);
 
-  if (my_id == nprocs-1)
-    MPI_Send(&local_dU[local_n+1], 1, MPI_DOUBLE, 0, 300, MPI_COMM_WORLD);
-  if (my_id == 0)	{
-    MPI_Recv(&temp, 1, MPI_DOUBLE, nprocs-1, 300, MPI_COMM_WORLD, &status);
-    global_dU[nx] = temp;
+    /* gathering locally computed derivatives from each process into root process */
+    MPI_Gatherv(local_dU, local_n, MPI_DOUBLE, global_dU, counts, displs, MPI_DOUBLE, 0, MPI_COMM_WORLD);
   }
-
-  MPI_Barrier(MPI_COMM_WORLD);
-  end_time = MPI_Wtime();
+  snprintf(variant, sizeof(variant), "%s%d%s", compact ? "compact" : "cds", order, (deriv == 2) ? "-d2" : "");
+  bench_report(&bench, "numerical_derivative_CDS", variant, nx, MPI_COMM_WORLD);
+  bench_free(&bench);
+  free(counts);
+  free(displs);
 
   /* writing results in an output file */
   if (my_id == 0)	{
-    fptr = fopen("first_derivative_dx_0.001.txt", "w");
+    snprintf(file_name, sizeof(file_name), "%s_derivative_dx_%g.txt", (deriv == 2) ? "second" : "first", dx);
+    fptr = fopen(file_name, "w");
     for(i = 0; i < nx+1; i++)	{
       x = xmin + i * dx;
-      fprintf(fptr, "%lf %lf %lf\n", x, tan(x) + x / (cos(x) * cos(x)), global_dU[i]);
+      if (deriv == 1) exact = tan(x) + x / (cos(x) * cos(x));
+      else exact = 2.0 * (1.0 + x * tan(x)) / (cos(x) * cos(x));
+      error = fabs(global_dU[i] - exact);
+      if (error > max_error) max_error = error;
+      if (fabs(x) <= 0.5 && error > interior_error) interior_error = error;	/* away from the boundary closures */
+      fprintf(fptr, "%lf %lf %lf\n", x, exact, global_dU[i]);
     }
     fclose(fptr);
+    printf("\n%s %s scheme of order %d, dx = %g: maximum error = %.3e (%.3e for |x| <= 0.5)\n",
+	   (deriv == 2) ? "Second derivative," : "First derivative,", compact ? "compact" : "explicit", order, dx, max_error, interior_error);
     free(global_dU);
   }  
 
-  if (my_id == 0) printf("\nProgram running time = %lf, processes used = %d\n", end_time-start_time, nprocs);
+  if (my_id == 0) printf("\nProcesses used = %d, threads per process = %d\n", nprocs, omp_get_max_threads());
   /* deallocating memory */
   free(local_U);
   free(local_dU);
+  if (compact)	{
+    free(local_rhs);
+    fd_compact_free(&cs);
+  }
     
   MPI_Finalize();  
   return 0;
@@ -0,0 +1,293 @@
+// MPI parallelized adaptive quadrature (Gauss-Kronrod or Simpson) with dynamic work distribution
+// The manager process (rank 0) keeps a stack of sub-intervals and hands them out on request to the worker processes.
+// A worker refines its sub-interval locally until the error estimate meets its share of the tolerance; when its refinement
+// budget is used up, the unfinished pieces are sent back to the manager, so that steep regions are spread over all workers.
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <mpi.h>
+#include "../Common/benchmark.h"
+
+#define PI 3.14159265358979323846
+
+#define MAX_RETURN 32		/* unfinished sub-intervals a worker can send back with one result */
+#define RESULT_SIZE (4 + 2 * MAX_RETURN)	/* integral, error, evaluations, number of returned intervals, their limits */
+#define TAG_TASK 1
+#define TAG_RESULT 2
+#define TAG_STOP 3
+
+typedef double (*integrand_t)(double x);
+
+/* estimate of the integral over [x_s, x_e] and of its error, n_eval is incremented by the number of evaluations */
+typedef double (*rule_t)(integrand_t f, double x_s, double x_e, double *error_p, long *n_eval);
+
+typedef struct	{		/* stack of sub-intervals */
+  double *a, *b;
+  int size, capacity;
+} interval_stack_t;
+
+double func_simpson(double x)	{
+  return (sin(x) / (2.0 * x * x * x));	/* integrand of the Simpson rule program, steep near x = 1 */
+}
+
+double func_trap(double x)	{
+  return (1.0 + sin(x));		/* integrand of the trapezoidal rule programs */
+}
+
+double func_peak(double x)	{
+  return (1.0 / (1.0e-4 + (x - 0.3) * (x - 0.3)));	/* sharp peak at x = 0.3 */
+}
+
+/* 15-point Kronrod rule with the embedded 7-point Gauss rule, the difference of the two is the error estimate */
+double gauss_kronrod_15(integrand_t f, double x_s, double x_e, double *error_p, long *n_eval)	{
+  static const double xk[8] = {0.991455371120812639206854697526329, 0.949107912342758524526189684047851, 0.864864423359769072789712788640926,
+			       0.741531185599394439863864773280788, 0.586087235467691130294144845693013, 0.405845151377397166906606412076961,
+			       0.207784955007898467600689403773245, 0.000000000000000000000000000000000};
+  static const double wk[8] = {0.022935322010529224963732008058970, 0.063092092629978553290700663189204, 0.104790010322250183839876322541518,
+			       0.140653259715525918745189590510238, 0.169004726639267902826583426598550, 0.190350578064785409913256402421014,
+			       0.204432940075298892414161999234649, 0.209482141084727828012999174891714};
+  static const double wg[4] = {0.129484966168869693270611432679082, 0.279705391489276667901467771423780, 0.381830050505118944950369775488975,
+			       0.417959183673469387755102040816327};
+  double c = 0.5 * (x_s + x_e), h = 0.5 * (x_e - x_s), fc, f1, f2, kronrod, gauss;
+  int j;
+
+  fc = f(c);
+  kronrod = wk[7] * fc;
+  gauss = wg[3] * fc;
+  for(j = 0; j < 7; j++)	{
+    f1 = f(c - h * xk[j]);
+    f2 = f(c + h * xk[j]);
+    kronrod += wk[j] * (f1 + f2);
+    if (j % 2 == 1) gauss += wg[j/2] * (f1 + f2);	/* the odd Kronrod nodes are the Gauss nodes */
+  }
+  *n_eval += 15;
+  *error_p = fabs((kronrod - gauss) * h);
+  return kronrod * h;
+}
+
+/* Simpson rule on [x_s, x_e] against the two half-interval Simpson rules, with Richardson's correction */
+double adaptive_simpson(integrand_t f, double x_s, double x_e, double *error_p, long *n_eval)	{
+  double h = x_e - x_s, m = 0.5 * (x_s + x_e), f_s = f(x_s), f_m = f(m), f_e = f(x_e);
+  double f_l = f(0.5 * (x_s + m)), f_r = f(0.5 * (m + x_e)), whole, halves;
+
+  whole = h / 6.0 * (f_s + 4.0 * f_m + f_e);
+  halves = h / 12.0 * (f_s + 4.0 * f_l + 2.0 * f_m + 4.0 * f_r + f_e);
+  *n_eval += 5;
+  *error_p = fabs(halves - whole) / 15.0;
+  return halves + (halves - whole) / 15.0;
+}
+
+void push_interval(interval_stack_t *s, double a, double b)	{
+
+  if (s->size == s->capacity)	{
+    s->capacity = s->capacity ? 2 * s->capacity : 64;
+    s->a = realloc(s->a, s->capacity * sizeof(double));
+    s->b = realloc(s->b, s->capacity * sizeof(double));
+  }
+  s->a[s->size] = a;
+  s->b[s->size] = b;
+  s->size++;
+  return;
+}
+
+/* refines [x_s, x_e] until every piece meets tol * (piece length) / (b - a), at most budget pieces are estimated */
+/* (budget < 0: no limit); the unfinished pieces are left on the stack, the accepted integral/error are accumulated */
+void refine(integrand_t f, rule_t rule, interval_stack_t *work, double tol_per_length, int budget, double *sum_p, double *err_p, long *n_eval)	{
+  double x_s, x_e, value, error;
+
+  while (work->size > 0 && budget != 0)	{
+    work->size--;
+    x_s = work->a[work->size];
+    x_e = work->b[work->size];
+    value = rule(f, x_s, x_e, &error, n_eval);
+    if (error <= tol_per_length * (x_e - x_s) || x_e - x_s <= 1.0e-12 * (fabs(x_s) + fabs(x_e)))	{	/* accepted (or no longer divisible) */
+      *sum_p += value;
+      *err_p += error;
+    }
+    else	{
+      push_interval(work, 0.5 * (x_s + x_e), x_e);
+      push_interval(work, x_s, 0.5 * (x_s + x_e));
+    }
+    if (budget > 0) budget--;
+  }
+  return;
+}
+
+/* manager: hands out sub-intervals until the stack is empty and every worker is idle, returns the integral and error */
+double manager(double a, double b, int nprocs, int ninit, double *error_p, long *n_eval, MPI_Comm comm)	{
+  interval_stack_t work = {NULL, NULL, 0, 0};
+  double result[RESULT_SIZE], task[2], sum = 0.0, err = 0.0;
+  int *idle, nidle = 0, busy = 0, i;
+  MPI_Status status;
+
+  idle = malloc(nprocs * sizeof(int));
+  for(i = ninit-1; i >= 0; i--)	/* initial uniform split, pushed so that the leftmost piece is handed out first */
+    push_interval(&work, a + (b - a) * i / ninit, a + (b - a) * (i + 1) / ninit);
+
+  while (work.size > 0 || busy > 0)	{
+    MPI_Recv(result, RESULT_SIZE, MPI_DOUBLE, MPI_ANY_SOURCE, TAG_RESULT, comm, &status);
+    sum += result[0];
+    err += result[1];
+    *n_eval += (long)result[2];
+    for(i = 0; i < (int)result[3]; i++) push_interval(&work, result[4+2*i], result[5+2*i]);
+    if (result[2] > 0.0) busy--;	/* the first request of a worker carries no result */
+    idle[nidle++] = status.MPI_SOURCE;
+
+    while (nidle > 0 && work.size > 0)	{	/* serve the waiting workers */
+      work.size--;
+      task[0] = work.a[work.size];
+      task[1] = work.b[work.size];
+      MPI_Send(task, 2, MPI_DOUBLE, idle[--nidle], TAG_TASK, comm);
+      busy++;
+    }
+  }
+
+  while (nidle < nprocs-1)	{	/* first requests of the workers that never got a task */
+    MPI_Recv(result, RESULT_SIZE, MPI_DOUBLE, MPI_ANY_SOURCE, TAG_RESULT, comm, &status);
+    idle[nidle++] = status.MPI_SOURCE;
+  }
+  for(i = 0; i < nidle; i++) MPI_Send(task, 0, MPI_DOUBLE, idle[i], TAG_STOP, comm);
+  free(idle);
+  free(work.a);
+  free(work.b);
+  *error_p = err;
+  return sum;
+}
+
+/* worker: requests sub-intervals, refines each within the budget and returns the result with the unfinished pieces */
+void worker(integrand_t f, rule_t rule, double tol_per_length, int budget, long *n_eval, MPI_Comm comm)	{
+  interval_stack_t work = {NULL, NULL, 0, 0};
+  double result[RESULT_SIZE] = {0.0}, task[2];
+  long evals;
+  int nret;
+  MPI_Status status;
+
+  while (1)	{
+    MPI_Send(result, RESULT_SIZE, MPI_DOUBLE, 0, TAG_RESULT, comm);	/* request, with the result of the previous task */
+    MPI_Recv(task, 2, MPI_DOUBLE, 0, MPI_ANY_TAG, comm, &status);
+    if (status.MPI_TAG == TAG_STOP) break;
+
+    evals = 0;
+    result[0] = result[1] = 0.0;
+    work.size = 0;
+    push_interval(&work, task[0], task[1]);
+    refine(f, rule, &work, tol_per_length, budget, &result[0], &result[1], &evals);
+
+    /* the pieces beyond MAX_RETURN are merged pairwise from the top of the stack, they are adjacent */
+    while (work.size > MAX_RETURN)	{
+      work.a[work.size-2] = work.a[work.size-1];
+      work.size--;
+    }
+    nret = work.size;
+    for(int i = 0; i < nret; i++)	{
+      result[4+2*i] = work.a[i];
+      result[5+2*i] = work.b[i];
+    }
+    result[2] = (double)evals;
+    result[3] = nret;
+    *n_eval += evals;
+  }
+  free(work.a);
+  free(work.b);
+  return;
+}
+
+/* static schedule for comparison: every process refines its own equal block of [a, b] without any exchange */
+double static_schedule(integrand_t f, rule_t rule, double a, double b, double tol_per_length, double *error_p, long *n_eval, MPI_Comm comm)	{
+  interval_stack_t work = {NULL, NULL, 0, 0};
+  double local_sum = 0.0, local_err = 0.0, local[2], global[2];
+  int my_id, nprocs;
+
+  MPI_Comm_rank(comm, &my_id);
+  MPI_Comm_size(comm, &nprocs);
+  push_interval(&work, a + (b - a) * my_id / nprocs, a + (b - a) * (my_id + 1) / nprocs);
+  refine(f, rule, &work, tol_per_length, -1, &local_sum, &local_err, n_eval);
+  local[0] = local_sum;
+  local[1] = local_err;
+  MPI_Reduce(local, global, 2, MPI_DOUBLE, MPI_SUM, 0, comm);
+  free(work.a);
+  free(work.b);
+  *error_p = global[1];
+  return global[0];
+}
+
+int main(int argc, char *argv[])	{
+
+  int my_id, nprocs, provided, budget = 64, ninit = 0;
+  double a, b, tol = 1.0e-10, exact, integration_result = 0.0, error_estimate = 0.0, imbalance;
+  const char *func_name = "simpson", *rule_name = "gk15", *schedule = "dynamic";
+  integrand_t f;
+  rule_t rule;
+  long n_eval, total_eval, max_eval, *rank_evals = NULL;
+  bench_t bench;
+  MPI_Comm comm;
+
+  MPI_Init_thread(&argc, &argv, MPI_THREAD_FUNNELED, &provided);	/* only the master thread makes MPI calls */
+  comm = MPI_COMM_WORLD;
+  MPI_Comm_size(comm, &nprocs);
+  MPI_Comm_rank(comm, &my_id);
+
+  for(int i = 1; i < argc-1; i++)	{
+    if (strcmp(argv[i], "-func") == 0)		func_name = argv[++i];
+    else if (strcmp(argv[i], "-rule") == 0)	rule_name = argv[++i];
+    else if (strcmp(argv[i], "-schedule") == 0)	schedule = argv[++i];
+    else if (strcmp(argv[i], "-tol") == 0)	tol = atof(argv[++i]);
+    else if (strcmp(argv[i], "-budget") == 0)	budget = atoi(argv[++i]);	/* pieces a worker estimates before it returns the rest */
+    else if (strcmp(argv[i], "-init") == 0)	ninit = atoi(argv[++i]);	/* initial uniform pieces of the manager */
+  }
+
+  /* integrand, default limits and exact value */
+  if (strcmp(func_name, "trap") == 0)	{
+    f = func_trap; a = 0.0; b = PI; exact = PI + 2.0;
+  }
+  else if (strcmp(func_name, "peak") == 0)	{
+    f = func_peak; a = 0.0; b = 1.0; exact = 100.0 * (atan(70.0) + atan(30.0));
+  }
+  else	{
+    f = func_simpson; a = 1.0; b = PI; exact = 0.198557298811136;
+  }
+  for(int i = 1; i < argc-1; i++)	{	/* other limits, the exact value is then unknown */
+    if (strcmp(argv[i], "-a") == 0)		{ a = atof(argv[++i]); exact = NAN; }
+    else if (strcmp(argv[i], "-b") == 0)	{ b = atof(argv[++i]); exact = NAN; }
+  }
+  rule = (strcmp(rule_name, "simpson") == 0) ? adaptive_simpson : gauss_kronrod_15;
+  if (ninit <= 0) ninit = 8 * nprocs;
+  if (budget == 0) budget = 1;
+  if (nprocs == 1) schedule = "static";	/* no workers to farm out to */
+
+  bench_init(&bench, argc, argv, 1, 5);
+  while (bench_next(&bench, comm))	{
+    n_eval = 0;
+    if (strcmp(schedule, "static") == 0)
+      integration_result = static_schedule(f, rule, a, b, tol / (b - a), &error_estimate, &n_eval, comm);
+    else if (my_id == 0)
+      integration_result = manager(a, b, nprocs, ninit, &error_estimate, &n_eval, comm);
+    else
+      worker(f, rule, tol / (b - a), budget, &n_eval, comm);
+  }
+  bench_report(&bench, "adaptive_quadrature", schedule, (long)(-log10(tol) + 0.5), comm);
+  bench_free(&bench);
+
+  /* evaluations per process of the last run: the manager's count is the total of the workers in the dynamic schedule */
+  if (strcmp(schedule, "dynamic") == 0 && my_id == 0) n_eval = 0;
+  if (my_id == 0) rank_evals = malloc(nprocs * sizeof(long));
+  MPI_Gather(&n_eval, 1, MPI_LONG, rank_evals, 1, MPI_LONG, 0, comm);
+  if (my_id == 0)	{
+    total_eval = max_eval = 0;
+    for(int r = 0; r < nprocs; r++)	{
+      total_eval += rank_evals[r];
+      if (rank_evals[r] > max_eval) max_eval = rank_evals[r];
+    }
+    imbalance = (strcmp(schedule, "dynamic") == 0 && nprocs > 1) ? max_eval * (nprocs - 1.0) / total_eval : max_eval * (double)nprocs / total_eval;
+    printf("\nThe integration (%s integrand, %s rule, %s schedule) between limits %lf and %lf = %0.15f\n", func_name, rule == gauss_kronrod_15 ? "gk15" : "simpson",
+	   schedule, a, b, integration_result);
+    printf("Error estimate = %e, error against the exact value = %e, tolerance = %e\n", error_estimate, fabs(integration_result - exact), tol);
+    printf("Function evaluations = %ld, max per process = %ld, load imbalance (max/mean over the working processes) = %.3lf\n", total_eval, max_eval, imbalance);
+    printf("Processes used = %d\n", nprocs);
+    free(rank_evals);
+  }
+
+  MPI_Finalize();
+  return 0;
+}
@@ -0,0 +1,325 @@
+// MPI parallelized integration over a d-dimensional box (d = 1..6) with tensor-product rules or quasi-Monte Carlo
+// The processes are arranged in a d-dimensional Cartesian grid (MPI_Dims_create/MPI_Cart_create) and the box [a,b]^d is split
+// along every dimension, so each process integrates its own sub-box: with the composite Simpson or Gauss-Legendre rule in every
+// dimension (tensor product), or with scrambled Sobol points (randomized quasi-Monte Carlo, independent streams per process).
+// The sub-box integrals are summed with MPI_Reduce.
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <math.h>
+#include <complex.h>
+#include <mpi.h>
+#include "../Common/block_decomposition.h"
+#include "../Common/benchmark.h"
+#ifdef _OPENMP
+#include <omp.h>
+#else
+#define omp_get_max_threads() 1
+#endif
+
+#define PI 3.14159265358979323846
+#define MAX_DIM 6		/* dimensions with Sobol direction numbers below */
+#define MAX_GAUSS 20		/* Gauss-Legendre points per panel */
+#define SOBOL_BITS 32
+
+typedef double (*integrand_t)(const double *x, int d);
+
+double func_gaussian(const double *x, int d)	{	/* exp(-|x|^2) */
+  double r2 = 0.0;
+
+  for(int k = 0; k < d; k++) r2 += x[k] * x[k];
+  return exp(-r2);
+}
+
+double func_cosine(const double *x, int d)	{	/* cos(x_1 + ... + x_d), oscillatory */
+  double s = 0.0;
+
+  for(int k = 0; k < d; k++) s += x[k];
+  return cos(s);
+}
+
+double func_peak(const double *x, int d)	{	/* product peak at the centre of [0,1]^d, 1/(1/c^2 + (x_k - 0.5)^2) with c = 10 */
+  double p = 1.0;
+
+  for(int k = 0; k < d; k++) p *= 1.0 / (0.01 + (x[k] - 0.5) * (x[k] - 0.5));
+  return p;
+}
+
+/* exact integrals over [a,b]^d, products of the one-dimensional integrals */
+double exact_integral(const char *func_name, double a, double b, int d)	{
+
+  if (strcmp(func_name, "cosine") == 0)	/* Re(((e^{ib} - e^{ia}) / i)^d) */
+    return creal(cpow((cexp(I * b) - cexp(I * a)) / I, d));
+  if (strcmp(func_name, "peak") == 0)
+    return pow(10.0 * (atan(10.0 * (b - 0.5)) - atan(10.0 * (a - 0.5))), d);
+  return pow(0.5 * sqrt(PI) * (erf(b) - erf(a)), d);
+}
+
+/* nodes t and weights w of the q-point Gauss-Legendre rule on [-1, 1] (Newton iteration on P_q) */
+void gauss_legendre(int q, double *t, double *w)	{
+  double z, z1, p1, p2, p3, pp;
+
+  for(int i = 0; i < q; i++)	{
+    z = cos(PI * (i + 0.75) / (q + 0.5));
+    do	{
+      p1 = 1.0;
+      p2 = 0.0;
+      for(int j = 1; j <= q; j++)	{
+	p3 = p2;
+	p2 = p1;
+	p1 = ((2.0 * j - 1.0) * z * p2 - (j - 1.0) * p3) / j;
+      }
+      pp = q * (z * p1 - p2) / (z * z - 1.0);
+      z1 = z;
+      z = z1 - p1 / pp;
+    } while (fabs(z - z1) > 1.0e-15);
+    t[i] = z;
+    w[i] = 2.0 / ((1.0 - z * z) * pp * pp);
+  }
+  return;
+}
+
+/* one-dimensional nodes and weights of this process along a dimension, for its block of the n divisions (Simpson) or */
+/* n panels (Gauss, q points each) of [a,b] split over nblocks processes; returns the number of nodes (allocated in *x_p, *w_p) */
+int local_rule(const char *rule, int q, double a, double b, int n, int nblocks, int block, double **x_p, double **w_p)	{
+  int start, size, count, i, j;
+  double h, t[MAX_GAUSS], wq[MAX_GAUSS], *x, *w;
+
+  if (strcmp(rule, "gauss") == 0)	{
+    block_range(n, nblocks, block, &start, &size);	/* panels */
+    count = size * q;
+    x = malloc((count + 1) * sizeof(double));
+    w = malloc((count + 1) * sizeof(double));
+    gauss_legendre(q, t, wq);
+    h = (b - a) / n;
+    for(i = 0; i < size; i++)
+      for(j = 0; j < q; j++)	{
+	x[i*q+j] = a + (start + i + 0.5 * (1.0 + t[j])) * h;
+	w[i*q+j] = 0.5 * h * wq[j];
+      }
+  }
+  else	{
+    block_range(n/2, nblocks, block, &start, &size);	/* pairs of divisions */
+    count = (size > 0) ? 2 * size + 1 : 0;
+    x = malloc((count + 1) * sizeof(double));
+    w = malloc((count + 1) * sizeof(double));
+    h = (b - a) / n;
+    for(i = 0; i < count; i++)	{	/* the end nodes of a block have weight h/3, shared nodes are counted by both blocks */
+      x[i] = a + (2 * start + i) * h;
+      w[i] = h / 3.0 * ((i == 0 || i == count-1) ? 1.0 : (i % 2 ? 4.0 : 2.0));
+    }
+  }
+  *x_p = x;
+  *w_p = w;
+  return count;
+}
+
+/* tensor product of the local one-dimensional rules over the sub-box of this process */
+double tensor_product(integrand_t f, int d, int *count, double **x, double **w, long *n_eval)	{
+  long outer = 1, inner = count[d-1];
+  double sum = 0.0;
+
+  for(int k = 0; k < d-1; k++) outer *= count[k];
+  if (outer == 0 || inner == 0) return 0.0;
+
+#pragma omp parallel for reduction(+:sum) schedule(static)
+  for(long o = 0; o < outer; o++)	{
+    double point[MAX_DIM], weight = 1.0, partial = 0.0;
+    long rest = o;
+
+    for(int k = d-2; k >= 0; k--)	{	/* multi-index of the outer dimensions */
+      int i = rest % count[k];
+      rest /= count[k];
+      point[k] = x[k][i];
+      weight *= w[k][i];
+    }
+    for(long j = 0; j < inner; j++)	{
+      point[d-1] = x[d-1][j];
+      partial += w[d-1][j] * f(point, d);
+    }
+    sum += weight * partial;
+  }
+  *n_eval += outer * inner;
+  return sum;
+}
+
+/* primitive polynomials (degree s, coefficients a) and initial direction numbers m of dimensions 2..6 (Joe and Kuo) */
+static const int sobol_s[MAX_DIM] = {0, 1, 2, 3, 3, 4};
+static const int sobol_a[MAX_DIM] = {0, 0, 1, 1, 2, 1};
+static const int sobol_m[MAX_DIM][4] = {{0}, {1}, {1, 3}, {1, 3, 1}, {1, 1, 1}, {1, 1, 3, 3}};
+
+uint64_t splitmix64(uint64_t *state)	{
+  uint64_t z = (*state += 0x9E3779B97F4A7C15ULL);
+
+  z = (z ^ (z >> 30)) * 0xBF58476D1CE4E5B9ULL;
+  z = (z ^ (z >> 27)) * 0x94D049BB133111EBULL;
+  return z ^ (z >> 31);
+}
+
+int parity32(uint32_t v)	{
+  v ^= v >> 16;
+  v ^= v >> 8;
+  v ^= v >> 4;
+  v ^= v >> 2;
+  v ^= v >> 1;
+  return v & 1;
+}
+
+/* direction numbers of the first d Sobol dimensions, scrambled with a random lower-triangular binary matrix per */
+/* dimension (linear matrix scrambling), and a random digital shift per dimension */
+void sobol_scrambled(int d, uint64_t *state, uint32_t v[][SOBOL_BITS], uint32_t *shift)	{
+  uint32_t m[SOBOL_BITS+1], row[SOBOL_BITS], scrambled;
+  int s, j, r;
+
+  for(int k = 0; k < d; k++)	{
+    s = sobol_s[k];
+    for(j = 1; j <= SOBOL_BITS; j++)	{
+      if (k == 0) m[j] = 1;			/* van der Corput */
+      else if (j <= s) m[j] = sobol_m[k][j-1];
+      else	{
+	m[j] = m[j-s] ^ (m[j-s] << s);
+	for(int l = 1; l < s; l++)
+	  if ((sobol_a[k] >> (s - 1 - l)) & 1) m[j] ^= m[j-l] << l;
+      }
+      v[k][j-1] = m[j] << (SOBOL_BITS - j);	/* binary fraction 0.m_j in the top bits */
+    }
+    for(r = 0; r < SOBOL_BITS; r++)	/* row r (digit 2^-(r+1)) has ones left of and on the diagonal */
+      row[r] = ((uint32_t)splitmix64(state) & (r ? ~0u << (SOBOL_BITS - r) : 0u)) | (1u << (SOBOL_BITS - 1 - r));
+    for(j = 0; j < SOBOL_BITS; j++)	{
+      scrambled = 0;
+      for(r = 0; r < SOBOL_BITS; r++)
+	scrambled |= (uint32_t)parity32(row[r] & v[k][j]) << (SOBOL_BITS - 1 - r);
+      v[k][j] = scrambled;
+    }
+    shift[k] = (uint32_t)splitmix64(state);
+  }
+  return;
+}
+
+/* randomized QMC over the sub-box [lo, hi] of this process: replicas independently scrambled Sobol streams of npoints */
+/* points each, seeded by (seed, rank, replica); returns the mean of the replicas and its variance in *var_p */
+double sobol_qmc(integrand_t f, int d, const double *lo, const double *hi, long npoints, int replicas, uint64_t seed, int rank, double *var_p, long *n_eval)	{
+  double volume = 1.0, mean = 0.0, m2 = 0.0, *est;
+
+  for(int k = 0; k < d; k++) volume *= hi[k] - lo[k];
+  est = malloc(replicas * sizeof(double));
+
+#pragma omp parallel for schedule(dynamic)
+  for(int rep = 0; rep < replicas; rep++)	{
+    uint32_t v[MAX_DIM][SOBOL_BITS], shift[MAX_DIM], code[MAX_DIM] = {0};
+    uint64_t state = seed ^ (0x9E3779B97F4A7C15ULL * (1 + (uint64_t)rank * replicas + rep));
+    double point[MAX_DIM], sum = 0.0;
+
+    sobol_scrambled(d, &state, v, shift);
+    for(long i = 0; i < npoints; i++)	{
+      if (i > 0)	{	/* Gray-code order: one direction number changes, the one of the lowest zero bit of i-1 */
+	int c = 0;
+	while ((i - 1) >> c & 1) c++;
+	for(int k = 0; k < d; k++) code[k] ^= v[k][c];
+      }
+      for(int k = 0; k < d; k++)
+	point[k] = lo[k] + (hi[k] - lo[k]) * (((code[k] ^ shift[k]) + 0.5) / 4294967296.0);
+      sum += f(point, d);
+    }
+    est[rep] = volume * sum / npoints;
+  }
+
+  for(int rep = 0; rep < replicas; rep++) mean += est[rep];
+  mean /= replicas;
+  for(int rep = 0; rep < replicas; rep++) m2 += (est[rep] - mean) * (est[rep] - mean);
+  *var_p = (replicas > 1) ? m2 / (replicas - 1.0) / replicas : 0.0;	/* variance of the mean of independent replicas */
+  *n_eval += npoints * replicas;
+  free(est);
+  return mean;
+}
+
+int main(int argc, char *argv[])	{
+
+  int my_id, nprocs, provided, d = 3, n = 32, q = 4, replicas = 8, dims[MAX_DIM] = {0}, periods[MAX_DIM] = {0}, coords[MAX_DIM];
+  int count[MAX_DIM], start, size;
+  double a = 0.0, b = 1.0, exact, local[2], global[2] = {0.0, 0.0}, *x[MAX_DIM], *w[MAX_DIM], lo[MAX_DIM], hi[MAX_DIM], h;
+  long points = 1L << 20, local_points, n_eval, total_eval;
+  uint64_t seed = 12345;
+  const char *func_name = "gaussian", *rule = "simpson";
+  integrand_t f;
+  bench_t bench;
+  MPI_Comm cart_comm;
+
+  MPI_Init_thread(&argc, &argv, MPI_THREAD_FUNNELED, &provided);	/* only the master thread makes MPI calls */
+  MPI_Comm_size(MPI_COMM_WORLD, &nprocs);
+  MPI_Comm_rank(MPI_COMM_WORLD, &my_id);
+
+  for(int i = 1; i < argc-1; i++)	{
+    if (strcmp(argv[i], "-dim") == 0)		d = atoi(argv[++i]);
+    else if (strcmp(argv[i], "-func") == 0)	func_name = argv[++i];
+    else if (strcmp(argv[i], "-rule") == 0)	rule = argv[++i];		/* simpson, gauss or qmc */
+    else if (strcmp(argv[i], "-n") == 0)	n = atoi(argv[++i]);		/* divisions (simpson) or panels (gauss) per dimension */
+    else if (strcmp(argv[i], "-q") == 0)	q = atoi(argv[++i]);		/* Gauss points per panel */
+    else if (strcmp(argv[i], "-points") == 0)	points = atol(argv[++i]);	/* quasi-Monte Carlo points in total */
+    else if (strcmp(argv[i], "-replicas") == 0)	replicas = atoi(argv[++i]);	/* independent scramblings per process */
+    else if (strcmp(argv[i], "-seed") == 0)	seed = strtoull(argv[++i], NULL, 10);
+    else if (strcmp(argv[i], "-a") == 0)	a = atof(argv[++i]);
+    else if (strcmp(argv[i], "-b") == 0)	b = atof(argv[++i]);
+  }
+  if (d < 1 || d > MAX_DIM || q < 1 || q > MAX_GAUSS || replicas < 1 || n < 1 || (strcmp(rule, "simpson") == 0 && n % 2 != 0))	{
+    if (my_id == 0) printf("Need 1 <= -dim <= %d, 1 <= -q <= %d, -replicas >= 1 and -n >= 1 (even for the Simpson rule). Exiting!!\n", MAX_DIM, MAX_GAUSS);
+    MPI_Finalize();
+    return 0;
+  }
+  f = (strcmp(func_name, "cosine") == 0) ? func_cosine : (strcmp(func_name, "peak") == 0) ? func_peak : func_gaussian;
+  exact = exact_integral(func_name, a, b, d);
+
+  MPI_Dims_create(nprocs, d, dims);	/* process grid, e.g. 12 processes in 3 dimensions: 3 x 2 x 2 */
+  MPI_Cart_create(MPI_COMM_WORLD, d, dims, periods, 1, &cart_comm);
+  MPI_Comm_rank(cart_comm, &my_id);
+  MPI_Cart_coords(cart_comm, my_id, d, coords);
+
+  /* sub-box of this process: for the tensor-product rules its nodes and weights per dimension */
+  for(int k = 0; k < d; k++)	{
+    if (strcmp(rule, "qmc") == 0)	{
+      block_range(n, dims[k], coords[k], &start, &size);	/* the box is cut on the grid of n divisions too */
+      h = (b - a) / n;
+      lo[k] = a + start * h;
+      hi[k] = lo[k] + size * h;
+      x[k] = w[k] = NULL;
+    }
+    else
+      count[k] = local_rule(rule, q, a, b, n, dims[k], coords[k], &x[k], &w[k]);
+  }
+  local_points = points / ((long)nprocs * replicas);	/* Sobol points are balanced in powers of two */
+  if (local_points < 1) local_points = 1;
+  while (local_points & (local_points - 1)) local_points &= local_points - 1;
+
+  bench_init(&bench, argc, argv, 1, 5);
+  while (bench_next(&bench, cart_comm))	{
+    n_eval = 0;
+    local[1] = 0.0;
+    if (strcmp(rule, "qmc") == 0)
+      local[0] = sobol_qmc(f, d, lo, hi, local_points, replicas, seed, my_id, &local[1], &n_eval);
+    else
+      local[0] = tensor_product(f, d, count, x, w, &n_eval);
+    MPI_Reduce(local, global, 2, MPI_DOUBLE, MPI_SUM, 0, cart_comm);	/* integral and variance (independent sub-boxes) */
+  }
+  bench_report(&bench, "multidimensional_integration", rule, (strcmp(rule, "qmc") == 0) ? points : n, cart_comm);
+  bench_free(&bench);
+  MPI_Reduce(&n_eval, &total_eval, 1, MPI_LONG, MPI_SUM, 0, cart_comm);
+
+  if (my_id == 0)	{
+    printf("\nThe integration (%s integrand, %s rule) over [%lf, %lf]^%d = %0.15f\n", func_name, rule, a, b, d, global[0]);
+    printf("Error against the exact value %0.15f = %e", exact, fabs(global[0] - exact));
+    if (strcmp(rule, "qmc") == 0) printf(", error estimate (standard error over the replicas) = %e", sqrt(global[1]));
+    printf("\nFunction evaluations = %ld\n", total_eval);
+    printf("Process grid = %d", dims[0]);
+    for(int k = 1; k < d; k++) printf(" x %d", dims[k]);
+    printf(", threads per process = %d\n", omp_get_max_threads());
+  }
+
+  for(int k = 0; k < d; k++)	{
+    free(x[k]);
+    free(w[k]);
+  }
+  MPI_Comm_free(&cart_comm);
+  MPI_Finalize();
+  return 0;
+}
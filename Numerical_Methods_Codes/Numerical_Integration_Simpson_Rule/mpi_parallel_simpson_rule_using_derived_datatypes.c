@@ -1,9 +1,20 @@
 // MPI parallelized version of Simpson rule using MPI derived data types
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
 #include <time.h>
 #include <math.h>
 #include <mpi.h>
+#include "../Common/block_decomposition.h"
+#include "../Common/benchmark.h"
+#include "../Common/batch_eval.h"
+#include "../Common/integral_tasks.h"
+#include "../Common/romberg.h"
+#ifdef _OPENMP
+#include <omp.h>
+#else
+#define omp_get_max_threads() 1
+#endif
 
 double func(double x)	{
   return (sin(x) / (2.0 * pow(x, 3)));	// given function to integrate
@@ -13,8 +24,11 @@ double simpson_rule(double x_s, double x_e, int n, double h)	{
 	
   double partial_sum, x;
   int i;
+
+  if (n == 0) return 0.0;	// empty block (more processes than pairs of divisions)
   partial_sum = (func(x_s) + func(x_e));
   
+#pragma omp parallel for private(x) reduction(+:partial_sum)
   for(i = 1; i <= n-1; i++)	{
     x = x_s + i * h;
     if ((i%2) == 0)	{
@@ -29,6 +43,49 @@ double simpson_rule(double x_s, double x_e, int n, double h)	{
   return partial_sum;
 }
 
+void func_batch(const double *x, double *fx, int count)	{	// given function evaluated over an array of points (vectorized)
+  int i;
+
+#pragma omp simd
+  for(i = 0; i < count; i++)
+    fx[i] = simd_sin(x[i]) / (2.0 * x[i] * x[i] * x[i]);
+}
+
+double simpson_rule_batch(double x_s, double x_e, int n, double h)	{	// same rule, odd and even points as two branch-free strided sums
+	
+  double odd_sum, even_sum;
+
+  if (n == 0) return 0.0;
+  odd_sum = batch_strided_sum(func_batch, x_s + h, 2.0 * h, n/2);		// j = 1, 3, ..., n-1
+  even_sum = batch_strided_sum(func_batch, x_s + 2.0 * h, 2.0 * h, n/2 - 1);	// j = 2, 4, ..., n-2
+  return (func(x_s) + func(x_e) + 4.0 * odd_sum + 2.0 * even_sum) * h / 3.0;
+}
+
+void simpson_rule_exact(double a, int n, double h, int nprocs, int my_id, exact_sum_t *acc)	{	// same rule without the factor h/3, summed exactly
+  long first, count;
+  double x[2] = {a, a + (double)(n/2) * (2.0 * h)}, fx[2];
+
+  batch_block_range(n/2, nprocs, my_id, &first, &count);	// odd points a + h + j*2h, j = 0..n/2-1, in whole batches of the global grid
+  batch_strided_deposit(func_batch, a + h, 2.0 * h, first, count, 4.0, acc);
+  batch_block_range(n/2 + 1, nprocs, my_id, &first, &count);	// even points a + j*2h, j = 0..n/2
+  batch_strided_deposit(func_batch, a, 2.0 * h, first, count, 2.0, acc);
+  if (my_id == 0)	{	// the two end points have weight 1 instead of 2
+    func_batch(x, fx, 2);
+    exact_sum_add(acc, -fx[0]);
+    exact_sum_add(acc, -fx[1]);
+  }
+}
+
+double simpson_task(double a, double b, int n, int exact)	{	// one integral of a task batch, computed by a single process
+  exact_sum_t acc;
+	
+  if (n <= 0 || n % 2 != 0) return NAN;	// Simpson rule works on pairs of divisions
+  if (!exact) return simpson_rule_batch(a, b, n, (b - a) / n);
+  exact_sum_init(&acc);
+  simpson_rule_exact(a, n, (b - a) / n, 1, 0, &acc);
+  return exact_sum_value(&acc) * ((b - a) / n) / 3.0;
+}
+
 void create_new_mpi_type(double* a_p, double* b_p, int* n_p, MPI_Datatype* new_mpi_type_p)	{	// subroutine to create a new mpi datatype
   int block_lengths[3] = {1, 1, 1};
   MPI_Datatype types[3] = {MPI_DOUBLE, MPI_DOUBLE, MPI_INT};
@@ -48,7 +105,7 @@ void create_new_mpi_type(double* a_p, double* b_p, int* n_p, MPI_Datatype* new_m
   MPI_Type_commit(new_mpi_type_p);	// commit new MPI datatype for MPI's bookkeeping
 }
 
-void read_user_input(int my_id, int nprocs, double* a_p, double* b_p, int* n_p)	{
+void read_user_input(int my_id, double* a_p, double* b_p, int* n_p)	{
   MPI_Datatype new_mpi_type;
 
   create_new_mpi_type(a_p, b_p, n_p, &new_mpi_type);
@@ -63,28 +120,86 @@ void read_user_input(int my_id, int nprocs, double* a_p, double* b_p, int* n_p)
 
 int main(int argc, char *argv[])	{
 
-  double a, b, integration_result, local_a, local_b, local_sum, h, exact_result;
-  int n, local_n, my_id, nprocs;
-  MPI_Status status;
+  double a, b, integration_result, local_a, local_b, local_sum, h, exact_result, tol = 0.0;	// tol > 0: Romberg integration to this absolute tolerance
+  int n, local_n, local_pairs, pair_start, my_id, nprocs, provided, i;
+  const char *eval = "batch";	// batch (vectorized) or scalar (one func() call per point) evaluation
+  const char *sum = "naive";	// naive (per-process sums and MPI_SUM, the original) or exact (reproducible, opt-in) summation
+  const char *task_file = NULL, *result_file = NULL;	// batch mode: the (a, b, n) tasks of a file, results to a file
+  int chunk = 1;	// tasks handed out per request to the manager
+  char variant[32];
+  exact_sum_t acc;
+  romberg_result_t romb = {0.0, 0.0, 0, 0, 0, 0};	// set by the timed runs
+  bench_t bench;
+  bench_stats_t stats;
 	
-  MPI_Init(&argc, &argv);
+  MPI_Init_thread(&argc, &argv, MPI_THREAD_FUNNELED, &provided);	// only the master thread makes MPI calls
   MPI_Comm_size(MPI_COMM_WORLD, &nprocs);
   MPI_Comm_rank(MPI_COMM_WORLD, &my_id);
 	
-  read_user_input(my_id, nprocs, &a, &b, &n);
+  for(i = 1; i < argc-1; i++)
+    if (strcmp(argv[i], "-eval") == 0) eval = argv[++i];
+    else if (strcmp(argv[i], "-sum") == 0) sum = argv[++i];
+    else if (strcmp(argv[i], "-tol") == 0) tol = atof(argv[++i]);
+    else if (strcmp(argv[i], "-tasks") == 0) task_file = argv[++i];
+    else if (strcmp(argv[i], "-results") == 0) result_file = argv[++i];
+    else if (strcmp(argv[i], "-chunk") == 0) chunk = atoi(argv[++i]);
+  if (task_file != NULL)	{	// one broadcast of all tasks, dynamic scheduling, one MPI_Gatherv of the results
+    run_task_file(simpson_task, task_file, result_file, chunk, strcmp(sum, "exact") == 0, "simpson_rule_derived_datatypes", argc, argv, MPI_COMM_WORLD);
+    MPI_Finalize();
+    return 0;
+  }
+  read_user_input(my_id, &a, &b, &n);
+  if (strcmp(eval, "scalar") == 0) sum = "naive";	// the scalar loop is the original, naively summed rule
+  snprintf(variant, sizeof(variant), "%s-%s", (tol > 0.0) ? "romberg" : eval, sum);
   integration_result = 0.0;
   exact_result = 0.198573;
   
+  if (n <= 0 || n % 2 != 0)	{	// Simpson rule works on pairs of divisions
+    if (my_id == 0) printf("\nThe number of divisions (%d) should be a positive even number. Exiting!!\n", n);
+    MPI_Finalize();
+    return 0;
+  }
+
   h = (b - a) / n;
-  local_n = n / nprocs;		// nprocs evenly divides with the number of divisions
-  local_a = a + my_id * local_n * h;
+  block_range(n/2, nprocs, my_id, &pair_start, &local_pairs);	// pairs are distributed so that every local block has an even number of divisions
+  local_n = 2 * local_pairs;
+  local_a = a + 2 * pair_start * h;
   local_b = local_a + local_n * h;
-  local_sum = simpson_rule(local_a, local_b, local_n, h);
-  MPI_Reduce(&local_sum, &integration_result, 1, MPI_DOUBLE, MPI_SUM, 0, MPI_COMM_WORLD);
+
+  bench_init(&bench, argc, argv, 1, 10);	// warm-up runs and timed trials of the integration
+  while (bench_next(&bench, MPI_COMM_WORLD))	{
+    if (tol > 0.0)	{	// n, 2n, 4n, ... divisions, each level evaluates only the new midpoints (column 1 of the tableau is this rule)
+      romb = romberg(func_batch, a, b, n, tol, strcmp(sum, "exact") == 0, MPI_COMM_WORLD);
+      integration_result = romb.value;
+    }
+    else if (strcmp(sum, "exact") == 0)	{	// same bits for any number of processes and threads
+      exact_sum_init(&acc);
+      simpson_rule_exact(a, n, h, nprocs, my_id, &acc);
+      integration_result = exact_sum_reduce(&acc, 0, MPI_COMM_WORLD) * h / 3.0;
+    }
+    else	{
+      if (strcmp(eval, "scalar") == 0)
+        local_sum = simpson_rule(local_a, local_b, local_n, h);
+      else
+        local_sum = simpson_rule_batch(local_a, local_b, local_n, h);
+      MPI_Reduce(&local_sum, &integration_result, 1, MPI_DOUBLE, MPI_SUM, 0, MPI_COMM_WORLD);
+    }
+  }
+  stats = bench_report(&bench, "simpson_rule_derived_datatypes", variant, (tol > 0.0) ? romb.n : n, MPI_COMM_WORLD);
+  bench_free(&bench);
 
   if (my_id == 0)	{
   	printf("\nThe integration for the given function between limits %lf and %lf = %0.9f\n", a, b, integration_result);
 	printf("Error associated between the numerically obtained value and the exact value = %0.9f\n", fabs(integration_result - exact_result));
+	printf("Result to 17 digits = %.17g (%s summation)\n", integration_result, sum);
+	if (tol > 0.0)	{
+	  printf("Romberg integration: %d levels up to n = %ld, estimated error = %e (tolerance %e)\n", romb.levels, romb.n, romb.error, tol);
+	  printf("Function evaluations = %ld (independent runs of the same levels: %ld)\n", romb.evals, romb.rerun_evals);
+	  printf("Function evaluations per second per core = %e (batch evaluation)\n", romb.evals / stats.median / (nprocs * omp_get_max_threads()));
+	}
+	else
+	  printf("Function evaluations per second per core = %e (%s evaluation)\n", (n + 1.0) / stats.median / (nprocs * omp_get_max_threads()), eval);
+	printf("Processes used = %d, threads per process = %d\n", nprocs, omp_get_max_threads());
   }
   
   MPI_Finalize();	
@@ -1,9 +1,19 @@
 // MPI parallelized version of trapezoidal rule using reduction operation
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
 #include <time.h>
 #include <math.h>
 #include <mpi.h>
+#include "../Common/block_decomposition.h"
+#include "../Common/benchmark.h"
+#include "../Common/batch_eval.h"
+#include "../Common/romberg.h"
+#ifdef _OPENMP
+#include <omp.h>
+#else
+#define omp_get_max_threads() 1
+#endif
 
 #define PI 3.14159265358
 
@@ -15,9 +25,11 @@ double trap_rule(double x_s, double x_e, int n, double h)	{
 	
 	double partial_sum, x;
 	int i;
-		
+	
+	if (n == 0) return 0.0;		// empty block (more processes than divisions)
 	partial_sum = (func(x_s) + func(x_e)) / 2.0;
 	
+#pragma omp parallel for private(x) reduction(+:partial_sum)
 	for(i = 1; i <= n-1; i++)	{
 		x = x_s + i * h;
 		partial_sum = partial_sum + func(x);
@@ -28,30 +40,99 @@ double trap_rule(double x_s, double x_e, int n, double h)	{
 	return partial_sum;
 }
 
+void func_batch(const double *x, double *fx, int count)	{	// given function evaluated over an array of points (vectorized)
+	int i;
+	
+#pragma omp simd
+	for(i = 0; i < count; i++)
+		fx[i] = 1.0 + simd_sin(x[i]);
+}
+
+double trap_rule_batch(double x_s, double x_e, int n, double h)	{	// same rule, interior points evaluated in vectorized batches
+	
+	if (n == 0) return 0.0;		// empty block (more processes than divisions)
+	return ((func(x_s) + func(x_e)) / 2.0 + batch_strided_sum(func_batch, x_s + h, h, n-1)) * h;
+}
+
+void trap_rule_exact(double a, int n, double h, int nprocs, int my_id, exact_sum_t *acc)	{	// same rule without the factor h, summed exactly
+	long first, count;
+	double x[2] = {a, a + (double)n * h}, fx[2];
+	
+	batch_block_range(n + 1, nprocs, my_id, &first, &count);	// points a + j*h, j = 0..n, in whole batches of the global grid
+	batch_strided_deposit(func_batch, a, h, first, count, 1.0, acc);
+	if (my_id == 0)	{	// the two end points have weight 1/2
+		func_batch(x, fx, 2);
+		exact_sum_add(acc, -0.5 * fx[0]);
+		exact_sum_add(acc, -0.5 * fx[1]);
+	}
+}
+
 int main(int argc, char *argv[])	{
 
-	double a, b, integration_result, local_a, local_b, local_sum, h;
-	int n, local_n, my_id, nprocs, i;
-	MPI_Status status;
+	double a, b, integration_result, local_a, local_b, local_sum, h, tol;
+	int n, local_n, local_start, my_id, nprocs, i, provided;
+	const char *eval = "batch";	// batch (vectorized) or scalar (one func() call per point) evaluation
+	const char *sum = "naive";	// naive (per-process sums and MPI_SUM, the original) or exact (reproducible, opt-in) summation
+	char variant[32];
+	exact_sum_t acc;
+	romberg_result_t romb = {0.0, 0.0, 0, 0, 0, 0};	// set by the timed runs
+	bench_t bench;
+	bench_stats_t stats;
 	
-	MPI_Init(&argc, &argv);
+	MPI_Init_thread(&argc, &argv, MPI_THREAD_FUNNELED, &provided);	// only the master thread makes MPI calls
 	MPI_Comm_size(MPI_COMM_WORLD, &nprocs);
 	MPI_Comm_rank(MPI_COMM_WORLD, &my_id);
 	
-	n = 1024;	// number of divisions for integration
+	n = 1024;	// number of divisions for integration (of the first level with -tol)
+	tol = 0.0;	// > 0: Romberg integration to this absolute tolerance
+	for(i = 1; i < argc-1; i++)
+		if (strcmp(argv[i], "-n") == 0) n = atoi(argv[++i]);
+		else if (strcmp(argv[i], "-eval") == 0) eval = argv[++i];
+		else if (strcmp(argv[i], "-sum") == 0) sum = argv[++i];
+		else if (strcmp(argv[i], "-tol") == 0) tol = atof(argv[++i]);
 	a = 0.0;	// integration lower limit
 	b = PI;	// integration upper limit
+	if (strcmp(eval, "scalar") == 0) sum = "naive";	// the scalar loop is the original, naively summed rule
+	snprintf(variant, sizeof(variant), "%s-%s", (tol > 0.0) ? "romberg" : eval, sum);
 	integration_result = 0.0;
 	
 	h = (b - a) / n;
-	local_n = n / nprocs;			// nprocs evenly divides with the number of divisions 
-	local_a = a + my_id * local_n * h;
+	block_range(n, nprocs, my_id, &local_start, &local_n);	// balanced blocks, any n and number of processes
+	local_a = a + local_start * h;
 	local_b = local_a + local_n * h;
-	local_sum = trap_rule(local_a, local_b, local_n, h);
 	
-	MPI_Reduce(&local_sum, &integration_result, 1, MPI_DOUBLE, MPI_SUM, 0, MPI_COMM_WORLD);
+	bench_init(&bench, argc, argv, 1, 10);	// warm-up runs and timed trials of the integration
+	while (bench_next(&bench, MPI_COMM_WORLD))	{
+		if (tol > 0.0)	{	// n, 2n, 4n, ... divisions, each level evaluates only the new midpoints
+			romb = romberg(func_batch, a, b, n, tol, strcmp(sum, "exact") == 0, MPI_COMM_WORLD);
+			integration_result = romb.value;
+		}
+		else if (strcmp(sum, "exact") == 0)	{	// same bits for any number of processes and threads
+			exact_sum_init(&acc);
+			trap_rule_exact(a, n, h, nprocs, my_id, &acc);
+			integration_result = exact_sum_reduce(&acc, 0, MPI_COMM_WORLD) * h;
+		}
+		else	{
+			if (strcmp(eval, "scalar") == 0)
+				local_sum = trap_rule(local_a, local_b, local_n, h);
+			else
+				local_sum = trap_rule_batch(local_a, local_b, local_n, h);
+			MPI_Reduce(&local_sum, &integration_result, 1, MPI_DOUBLE, MPI_SUM, 0, MPI_COMM_WORLD);
+		}
+	}
+	stats = bench_report(&bench, "trap_rule_reduction", variant, (tol > 0.0) ? romb.n : n, MPI_COMM_WORLD);
+	bench_free(&bench);
 	if (my_id == 0)	{
 		printf("\nThe integration for the given function between limits %lf and %lf = %lf.\n", a, b, integration_result);
+		printf("Result to 17 digits = %.17g (%s summation)\n", integration_result, sum);
+		if (tol > 0.0)	{
+			printf("Romberg integration: %d levels up to n = %ld, estimated error = %e (tolerance %e)\n", romb.levels, romb.n, romb.error, tol);
+			printf("Function evaluations = %ld (independent runs of the same levels: %ld)\n", romb.evals, romb.rerun_evals);
+			printf("Function evaluations per second per core = %e (batch evaluation)\n", romb.evals / stats.median / (nprocs * omp_get_max_threads()));
+		}
+		else
+			printf("Function evaluations per second per core = %e (%s evaluation)\n", (n + 1.0) / stats.median / (nprocs * omp_get_max_threads()), eval);
+		printf("Processes used = %d, threads per process = %d\n", nprocs, omp_get_max_threads());
 	}
 	
 	MPI_Finalize();	
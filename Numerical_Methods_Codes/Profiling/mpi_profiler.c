@@ -0,0 +1,534 @@
+// PMPI profiling layer for the MPI programs
+// Linked in front of the MPI library (or loaded with LD_PRELOAD), it intercepts the MPI calls used by the programs and records for
+// every call type the number of calls, the bytes of the local buffers and the time, split into the time spent waiting for the other
+// processes and the time spent transferring:
+//   blocking collectives: a PMPI_Barrier is entered first, the time in it is the wait (late arrival of the other processes)
+//   MPI_Recv, MPI_Sendrecv: a PMPI_Probe for the incoming message is the wait (MPI_Sendrecv posts its send with PMPI_Isend first)
+//   MPI_Wait, MPI_Waitall, MPI_Test, MPI_Barrier: all wait, the transfer is counted at the MPI_Isend/MPI_Irecv/non-blocking collective
+//   MPI_Send, MPI_Sendrecv_replace, MPI-IO: all transfer
+// At MPI_Finalize the per-process counters are reduced onto the root, which prints a load-imbalance summary, and every call is written
+// to a Chrome trace file (chrome://tracing or https://ui.perfetto.dev), one row per process, with the wait shown as a nested slice.
+// Environment: MPIPROF_WAIT=0 turns the barrier/probe wait measurement off, MPIPROF_TRACE=<file> (default mpi_profile_trace.json,
+//              empty for no trace), MPIPROF_MAX_EVENTS=<events per process> (default 100000, later calls are only counted)
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <mpi.h>
+
+enum	{
+  P_SEND, P_RECV, P_SENDRECV, P_SENDRECV_REPLACE, P_ISEND, P_IRECV, P_WAIT, P_WAITALL, P_TEST, P_START,
+  P_BARRIER, P_BCAST, P_REDUCE, P_ALLREDUCE, P_SCATTER, P_SCATTERV, P_GATHER, P_GATHERV, P_ALLGATHER, P_ALLGATHERV,
+  P_ALLTOALL, P_ALLTOALLV, P_IALLGATHERV, P_INEIGHBOR_ALLTOALLV,
+  P_FILE_READ_AT_ALL, P_FILE_WRITE_AT_ALL, P_FILE_WRITE_AT, P_FILE_IREAD_AT, P_FILE_IWRITE_AT, NCALLS
+};
+
+static const char *call_names[NCALLS] = {
+  "MPI_Send", "MPI_Recv", "MPI_Sendrecv", "MPI_Sendrecv_replace", "MPI_Isend", "MPI_Irecv", "MPI_Wait", "MPI_Waitall", "MPI_Test", "MPI_Start",
+  "MPI_Barrier", "MPI_Bcast", "MPI_Reduce", "MPI_Allreduce", "MPI_Scatter", "MPI_Scatterv", "MPI_Gather", "MPI_Gatherv", "MPI_Allgather", "MPI_Allgatherv",
+  "MPI_Alltoall", "MPI_Alltoallv", "MPI_Iallgatherv", "MPI_Ineighbor_alltoallv",
+  "MPI_File_read_at_all", "MPI_File_write_at_all", "MPI_File_write_at", "MPI_File_iread_at", "MPI_File_iwrite_at"
+};
+
+typedef struct	{		/* counters of one call type on this process */
+  double count, bytes, time, wait;
+} call_stats_t;
+
+typedef struct	{		/* one call in the timeline, times relative to the end of MPI_Init */
+  int call;
+  double start, duration, wait, bytes;
+} event_t;
+
+static call_stats_t stats[NCALLS];
+static event_t *events = NULL;
+static int nevents = 0, max_events = 100000, wait_mode = 1;
+static long dropped_events = 0;
+static double t_origin;
+static const char *trace_file = "mpi_profile_trace.json";
+
+static void profiler_start(void)	{
+  const char *env;
+
+  if ((env = getenv("MPIPROF_WAIT")) != NULL) wait_mode = atoi(env);
+  if ((env = getenv("MPIPROF_MAX_EVENTS")) != NULL) max_events = atoi(env);
+  if ((env = getenv("MPIPROF_TRACE")) != NULL) trace_file = env;
+  if (max_events < 0) max_events = 0;
+  events = malloc((max_events + 1) * sizeof(event_t));
+  PMPI_Barrier(MPI_COMM_WORLD);	/* common time origin for the timeline */
+  t_origin = PMPI_Wtime();
+  return;
+}
+
+/* call started at t0, waited until t1 and returned at t2 */
+static void record(int call, double t0, double t1, double t2, double bytes)	{
+
+  stats[call].count += 1.0;
+  stats[call].bytes += bytes;
+  stats[call].time += t2 - t0;
+  stats[call].wait += t1 - t0;
+  if (nevents < max_events)	{
+    events[nevents].call = call;
+    events[nevents].start = t0 - t_origin;
+    events[nevents].duration = t2 - t0;
+    events[nevents].wait = t1 - t0;
+    events[nevents].bytes = bytes;
+    nevents++;
+  }
+  else
+    dropped_events++;
+  return;
+}
+
+static double type_bytes(MPI_Datatype type, long count)	{
+  int size;
+
+  if (type == MPI_DATATYPE_NULL || count <= 0) return 0.0;
+  PMPI_Type_size(type, &size);
+  return (double)size * count;
+}
+
+static long sum_counts(const int *counts, int n)	{
+  long sum = 0;
+
+  for(int i = 0; i < n; i++) sum += counts[i];
+  return sum;
+}
+
+/* wait of a blocking collective: the time until the last process has arrived */
+static double collective_wait(MPI_Comm comm)	{
+
+  if (wait_mode) PMPI_Barrier(comm);
+  return PMPI_Wtime();
+}
+
+static int comm_size(MPI_Comm comm)	{
+  int size;
+
+  PMPI_Comm_size(comm, &size);
+  return size;
+}
+
+static int comm_rank(MPI_Comm comm)	{
+  int rank;
+
+  PMPI_Comm_rank(comm, &rank);
+  return rank;
+}
+
+int MPI_Init(int *argc, char ***argv)	{
+  int err = PMPI_Init(argc, argv);
+
+  profiler_start();
+  return err;
+}
+
+int MPI_Init_thread(int *argc, char ***argv, int required, int *provided)	{
+  int err = PMPI_Init_thread(argc, argv, required, provided);
+
+  profiler_start();
+  return err;
+}
+
+/* ---------------------------------------- point-to-point ---------------------------------------- */
+
+int MPI_Send(const void *buf, int count, MPI_Datatype type, int dest, int tag, MPI_Comm comm)	{
+  double t0 = PMPI_Wtime();
+  int err = PMPI_Send(buf, count, type, dest, tag, comm);
+
+  record(P_SEND, t0, t0, PMPI_Wtime(), type_bytes(type, count));
+  return err;
+}
+
+int MPI_Recv(void *buf, int count, MPI_Datatype type, int source, int tag, MPI_Comm comm, MPI_Status *status)	{
+  double t0 = PMPI_Wtime(), t1 = t0;
+  MPI_Status probe_status;
+  int err;
+
+  if (wait_mode && source != MPI_PROC_NULL)	{	/* wait for the message, then receive exactly the probed one */
+    PMPI_Probe(source, tag, comm, &probe_status);
+    t1 = PMPI_Wtime();
+    source = probe_status.MPI_SOURCE;
+    tag = probe_status.MPI_TAG;
+  }
+  err = PMPI_Recv(buf, count, type, source, tag, comm, status);
+  record(P_RECV, t0, t1, PMPI_Wtime(), type_bytes(type, count));
+  return err;
+}
+
+int MPI_Sendrecv(const void *sendbuf, int sendcount, MPI_Datatype sendtype, int dest, int sendtag,
+		 void *recvbuf, int recvcount, MPI_Datatype recvtype, int source, int recvtag, MPI_Comm comm, MPI_Status *status)	{
+  double t0 = PMPI_Wtime(), t1 = t0;
+  MPI_Status probe_status;
+  MPI_Request request;
+  int err;
+
+  if (wait_mode && source != MPI_PROC_NULL)	{	/* the send is posted first, so probing can not deadlock */
+    PMPI_Isend(sendbuf, sendcount, sendtype, dest, sendtag, comm, &request);
+    PMPI_Probe(source, recvtag, comm, &probe_status);
+    t1 = PMPI_Wtime();
+    err = PMPI_Recv(recvbuf, recvcount, recvtype, probe_status.MPI_SOURCE, probe_status.MPI_TAG, comm, status);
+    PMPI_Wait(&request, MPI_STATUS_IGNORE);
+  }
+  else
+    err = PMPI_Sendrecv(sendbuf, sendcount, sendtype, dest, sendtag, recvbuf, recvcount, recvtype, source, recvtag, comm, status);
+  record(P_SENDRECV, t0, t1, PMPI_Wtime(), type_bytes(sendtype, sendcount) + type_bytes(recvtype, recvcount));
+  return err;
+}
+
+int MPI_Sendrecv_replace(void *buf, int count, MPI_Datatype type, int dest, int sendtag, int source, int recvtag, MPI_Comm comm, MPI_Status *status)	{
+  double t0 = PMPI_Wtime();
+  int err = PMPI_Sendrecv_replace(buf, count, type, dest, sendtag, source, recvtag, comm, status);
+
+  record(P_SENDRECV_REPLACE, t0, t0, PMPI_Wtime(), 2.0 * type_bytes(type, count));
+  return err;
+}
+
+int MPI_Isend(const void *buf, int count, MPI_Datatype type, int dest, int tag, MPI_Comm comm, MPI_Request *request)	{
+  double t0 = PMPI_Wtime();
+  int err = PMPI_Isend(buf, count, type, dest, tag, comm, request);
+
+  record(P_ISEND, t0, t0, PMPI_Wtime(), type_bytes(type, count));
+  return err;
+}
+
+int MPI_Irecv(void *buf, int count, MPI_Datatype type, int source, int tag, MPI_Comm comm, MPI_Request *request)	{
+  double t0 = PMPI_Wtime();
+  int err = PMPI_Irecv(buf, count, type, source, tag, comm, request);
+
+  record(P_IRECV, t0, t0, PMPI_Wtime(), type_bytes(type, count));
+  return err;
+}
+
+int MPI_Wait(MPI_Request *request, MPI_Status *status)	{
+  double t0 = PMPI_Wtime(), t1;
+  int err = PMPI_Wait(request, status);
+
+  t1 = PMPI_Wtime();
+  record(P_WAIT, t0, t1, t1, 0.0);
+  return err;
+}
+
+int MPI_Waitall(int count, MPI_Request requests[], MPI_Status statuses[])	{
+  double t0 = PMPI_Wtime(), t1;
+  int err = PMPI_Waitall(count, requests, statuses);
+
+  t1 = PMPI_Wtime();
+  record(P_WAITALL, t0, t1, t1, 0.0);
+  return err;
+}
+
+int MPI_Test(MPI_Request *request, int *flag, MPI_Status *status)	{
+  double t0 = PMPI_Wtime(), t1;
+  int err = PMPI_Test(request, flag, status);
+
+  t1 = PMPI_Wtime();
+  record(P_TEST, t0, t1, t1, 0.0);
+  return err;
+}
+
+int MPI_Start(MPI_Request *request)	{
+  double t0 = PMPI_Wtime();
+  int err = PMPI_Start(request);
+
+  record(P_START, t0, t0, PMPI_Wtime(), 0.0);
+  return err;
+}
+
+/* ---------------------------------------- collectives ---------------------------------------- */
+
+int MPI_Barrier(MPI_Comm comm)	{
+  double t0 = PMPI_Wtime(), t1;
+  int err = PMPI_Barrier(comm);
+
+  t1 = PMPI_Wtime();
+  record(P_BARRIER, t0, t1, t1, 0.0);
+  return err;
+}
+
+int MPI_Bcast(void *buf, int count, MPI_Datatype type, int root, MPI_Comm comm)	{
+  double t0 = PMPI_Wtime(), t1 = collective_wait(comm);
+  int err = PMPI_Bcast(buf, count, type, root, comm);
+
+  record(P_BCAST, t0, t1, PMPI_Wtime(), type_bytes(type, count));
+  return err;
+}
+
+int MPI_Reduce(const void *sendbuf, void *recvbuf, int count, MPI_Datatype type, MPI_Op op, int root, MPI_Comm comm)	{
+  double t0 = PMPI_Wtime(), t1 = collective_wait(comm);
+  int err = PMPI_Reduce(sendbuf, recvbuf, count, type, op, root, comm);
+
+  record(P_REDUCE, t0, t1, PMPI_Wtime(), type_bytes(type, count));
+  return err;
+}
+
+int MPI_Allreduce(const void *sendbuf, void *recvbuf, int count, MPI_Datatype type, MPI_Op op, MPI_Comm comm)	{
+  double t0 = PMPI_Wtime(), t1 = collective_wait(comm);
+  int err = PMPI_Allreduce(sendbuf, recvbuf, count, type, op, comm);
+
+  record(P_ALLREDUCE, t0, t1, PMPI_Wtime(), type_bytes(type, count));
+  return err;
+}
+
+int MPI_Scatter(const void *sendbuf, int sendcount, MPI_Datatype sendtype, void *recvbuf, int recvcount, MPI_Datatype recvtype, int root, MPI_Comm comm)	{
+  double t0 = PMPI_Wtime(), t1 = collective_wait(comm), bytes = type_bytes(recvtype, recvcount);
+  int err = PMPI_Scatter(sendbuf, sendcount, sendtype, recvbuf, recvcount, recvtype, root, comm);
+
+  if (comm_rank(comm) == root) bytes += type_bytes(sendtype, (long)sendcount * comm_size(comm));
+  record(P_SCATTER, t0, t1, PMPI_Wtime(), bytes);
+  return err;
+}
+
+int MPI_Scatterv(const void *sendbuf, const int sendcounts[], const int displs[], MPI_Datatype sendtype,
+		 void *recvbuf, int recvcount, MPI_Datatype recvtype, int root, MPI_Comm comm)	{
+  double t0 = PMPI_Wtime(), t1 = collective_wait(comm), bytes = type_bytes(recvtype, recvcount);
+  int err = PMPI_Scatterv(sendbuf, sendcounts, displs, sendtype, recvbuf, recvcount, recvtype, root, comm);
+
+  if (comm_rank(comm) == root) bytes += type_bytes(sendtype, sum_counts(sendcounts, comm_size(comm)));
+  record(P_SCATTERV, t0, t1, PMPI_Wtime(), bytes);
+  return err;
+}
+
+int MPI_Gather(const void *sendbuf, int sendcount, MPI_Datatype sendtype, void *recvbuf, int recvcount, MPI_Datatype recvtype, int root, MPI_Comm comm)	{
+  double t0 = PMPI_Wtime(), t1 = collective_wait(comm), bytes = type_bytes(sendtype, sendcount);
+  int err = PMPI_Gather(sendbuf, sendcount, sendtype, recvbuf, recvcount, recvtype, root, comm);
+
+  if (comm_rank(comm) == root) bytes += type_bytes(recvtype, (long)recvcount * comm_size(comm));
+  record(P_GATHER, t0, t1, PMPI_Wtime(), bytes);
+  return err;
+}
+
+int MPI_Gatherv(const void *sendbuf, int sendcount, MPI_Datatype sendtype, void *recvbuf, const int recvcounts[], const int displs[],
+		MPI_Datatype recvtype, int root, MPI_Comm comm)	{
+  double t0 = PMPI_Wtime(), t1 = collective_wait(comm), bytes = type_bytes(sendtype, sendcount);
+  int err = PMPI_Gatherv(sendbuf, sendcount, sendtype, recvbuf, recvcounts, displs, recvtype, root, comm);
+
+  if (comm_rank(comm) == root) bytes += type_bytes(recvtype, sum_counts(recvcounts, comm_size(comm)));
+  record(P_GATHERV, t0, t1, PMPI_Wtime(), bytes);
+  return err;
+}
+
+int MPI_Allgather(const void *sendbuf, int sendcount, MPI_Datatype sendtype, void *recvbuf, int recvcount, MPI_Datatype recvtype, MPI_Comm comm)	{
+  double t0 = PMPI_Wtime(), t1 = collective_wait(comm);
+  int err = PMPI_Allgather(sendbuf, sendcount, sendtype, recvbuf, recvcount, recvtype, comm);
+
+  record(P_ALLGATHER, t0, t1, PMPI_Wtime(), type_bytes(sendtype, sendcount) + type_bytes(recvtype, (long)recvcount * comm_size(comm)));
+  return err;
+}
+
+int MPI_Allgatherv(const void *sendbuf, int sendcount, MPI_Datatype sendtype, void *recvbuf, const int recvcounts[], const int displs[],
+		   MPI_Datatype recvtype, MPI_Comm comm)	{
+  double t0 = PMPI_Wtime(), t1 = collective_wait(comm);
+  int err = PMPI_Allgatherv(sendbuf, sendcount, sendtype, recvbuf, recvcounts, displs, recvtype, comm);
+
+  record(P_ALLGATHERV, t0, t1, PMPI_Wtime(), type_bytes(sendtype, sendcount) + type_bytes(recvtype, sum_counts(recvcounts, comm_size(comm))));
+  return err;
+}
+
+int MPI_Alltoall(const void *sendbuf, int sendcount, MPI_Datatype sendtype, void *recvbuf, int recvcount, MPI_Datatype recvtype, MPI_Comm comm)	{
+  double t0 = PMPI_Wtime(), t1 = collective_wait(comm);
+  int err = PMPI_Alltoall(sendbuf, sendcount, sendtype, recvbuf, recvcount, recvtype, comm);
+  long p = comm_size(comm);
+
+  record(P_ALLTOALL, t0, t1, PMPI_Wtime(), type_bytes(sendtype, sendcount * p) + type_bytes(recvtype, recvcount * p));
+  return err;
+}
+
+int MPI_Alltoallv(const void *sendbuf, const int sendcounts[], const int sdispls[], MPI_Datatype sendtype,
+		  void *recvbuf, const int recvcounts[], const int rdispls[], MPI_Datatype recvtype, MPI_Comm comm)	{
+  double t0 = PMPI_Wtime(), t1 = collective_wait(comm);
+  int err = PMPI_Alltoallv(sendbuf, sendcounts, sdispls, sendtype, recvbuf, recvcounts, rdispls, recvtype, comm);
+  int p = comm_size(comm);
+
+  record(P_ALLTOALLV, t0, t1, PMPI_Wtime(), type_bytes(sendtype, sum_counts(sendcounts, p)) + type_bytes(recvtype, sum_counts(recvcounts, p)));
+  return err;
+}
+
+int MPI_Iallgatherv(const void *sendbuf, int sendcount, MPI_Datatype sendtype, void *recvbuf, const int recvcounts[], const int displs[],
+		    MPI_Datatype recvtype, MPI_Comm comm, MPI_Request *request)	{
+  double t0 = PMPI_Wtime();
+  int err = PMPI_Iallgatherv(sendbuf, sendcount, sendtype, recvbuf, recvcounts, displs, recvtype, comm, request);
+
+  record(P_IALLGATHERV, t0, t0, PMPI_Wtime(), type_bytes(sendtype, sendcount) + type_bytes(recvtype, sum_counts(recvcounts, comm_size(comm))));
+  return err;
+}
+
+int MPI_Ineighbor_alltoallv(const void *sendbuf, const int sendcounts[], const int sdispls[], MPI_Datatype sendtype,
+			    void *recvbuf, const int recvcounts[], const int rdispls[], MPI_Datatype recvtype, MPI_Comm comm, MPI_Request *request)	{
+  double t0 = PMPI_Wtime();
+  int err = PMPI_Ineighbor_alltoallv(sendbuf, sendcounts, sdispls, sendtype, recvbuf, recvcounts, rdispls, recvtype, comm, request);
+  int indegree, outdegree, weighted;
+
+  PMPI_Dist_graph_neighbors_count(comm, &indegree, &outdegree, &weighted);
+  record(P_INEIGHBOR_ALLTOALLV, t0, t0, PMPI_Wtime(), type_bytes(sendtype, sum_counts(sendcounts, outdegree)) + type_bytes(recvtype, sum_counts(recvcounts, indegree)));
+  return err;
+}
+
+/* ---------------------------------------- MPI-IO ---------------------------------------- */
+
+int MPI_File_read_at_all(MPI_File fh, MPI_Offset offset, void *buf, int count, MPI_Datatype type, MPI_Status *status)	{
+  double t0 = PMPI_Wtime();
+  int err = PMPI_File_read_at_all(fh, offset, buf, count, type, status);
+
+  record(P_FILE_READ_AT_ALL, t0, t0, PMPI_Wtime(), type_bytes(type, count));
+  return err;
+}
+
+int MPI_File_write_at_all(MPI_File fh, MPI_Offset offset, const void *buf, int count, MPI_Datatype type, MPI_Status *status)	{
+  double t0 = PMPI_Wtime();
+  int err = PMPI_File_write_at_all(fh, offset, buf, count, type, status);
+
+  record(P_FILE_WRITE_AT_ALL, t0, t0, PMPI_Wtime(), type_bytes(type, count));
+  return err;
+}
+
+int MPI_File_write_at(MPI_File fh, MPI_Offset offset, const void *buf, int count, MPI_Datatype type, MPI_Status *status)	{
+  double t0 = PMPI_Wtime();
+  int err = PMPI_File_write_at(fh, offset, buf, count, type, status);
+
+  record(P_FILE_WRITE_AT, t0, t0, PMPI_Wtime(), type_bytes(type, count));
+  return err;
+}
+
+int MPI_File_iread_at(MPI_File fh, MPI_Offset offset, void *buf, int count, MPI_Datatype type, MPI_Request *request)	{
+  double t0 = PMPI_Wtime();
+  int err = PMPI_File_iread_at(fh, offset, buf, count, type, request);
+
+  record(P_FILE_IREAD_AT, t0, t0, PMPI_Wtime(), type_bytes(type, count));
+  return err;
+}
+
+int MPI_File_iwrite_at(MPI_File fh, MPI_Offset offset, const void *buf, int count, MPI_Datatype type, MPI_Request *request)	{
+  double t0 = PMPI_Wtime();
+  int err = PMPI_File_iwrite_at(fh, offset, buf, count, type, request);
+
+  record(P_FILE_IWRITE_AT, t0, t0, PMPI_Wtime(), type_bytes(type, count));
+  return err;
+}
+
+/* ---------------------------------------- reports ---------------------------------------- */
+
+/* root only: one row per call type that was used, min/mean/max of the time over the processes */
+static void print_call_table(double *sum, double *min_time, double *max_time, int nprocs)	{
+
+  printf("%-24s %12s %14s %12s %12s %12s %12s %12s %10s\n", "call", "calls/proc", "MB/proc", "time min", "time mean", "time max",
+	 "wait mean", "transfer", "max/mean");
+  for(int c = 0; c < NCALLS; c++)	{
+    double *s = &sum[4*c], mean;
+    if (s[0] == 0.0) continue;
+    mean = s[2] / nprocs;
+    printf("%-24s %12.1lf %14.3lf %12.6lf %12.6lf %12.6lf %12.6lf %12.6lf %10.2lf\n", call_names[c], s[0] / nprocs, s[1] / nprocs / 1.0e6,
+	   min_time[c], mean, max_time[c], s[3] / nprocs, mean - s[3] / nprocs, mean > 0.0 ? max_time[c] / mean : 1.0);
+  }
+  return;
+}
+
+/* root only: per-process compute (outside MPI), MPI and wait times and their imbalance */
+static void print_imbalance(double *rank_times, int nprocs)	{
+  double mean[3] = {0.0, 0.0, 0.0}, max[3] = {0.0, 0.0, 0.0};
+  const char *names[3] = {"compute", "MPI", "MPI wait"};
+
+  for(int r = 0; r < nprocs; r++)	{
+    for(int k = 0; k < 3; k++)	{
+      mean[k] += rank_times[3*r+k] / nprocs;
+      if (rank_times[3*r+k] > max[k]) max[k] = rank_times[3*r+k];
+    }
+    if (nprocs <= 16)
+      printf("process %4d: compute = %lf, MPI = %lf (wait %lf, transfer %lf)\n", r, rank_times[3*r], rank_times[3*r+1], rank_times[3*r+2],
+	     rank_times[3*r+1] - rank_times[3*r+2]);
+  }
+  for(int k = 0; k < 3; k++)
+    printf("%-8s time: mean = %lf, max = %lf, imbalance (max/mean) = %.3lf, percent imbalance ((max-mean)/max) = %.1lf%%\n", names[k], mean[k], max[k],
+	   mean[k] > 0.0 ? max[k] / mean[k] : 1.0, max[k] > 0.0 ? 100.0 * (max[k] - mean[k]) / max[k] : 0.0);
+  return;
+}
+
+/* root only: Chrome trace, one thread row per process, wait shown as a nested slice of the call */
+static void write_trace(event_t *all_events, int *counts, int nprocs)	{
+  FILE *fptr = fopen(trace_file, "w");
+  event_t *e = all_events;
+  int first = 1;
+
+  if (fptr == NULL)	{
+    printf("Could not open '%s' for the MPI trace.\n", trace_file);
+    return;
+  }
+  fprintf(fptr, "{\"displayTimeUnit\": \"ms\", \"traceEvents\": [\n");
+  for(int r = 0; r < nprocs; r++)	{
+    fprintf(fptr, "%s{\"name\": \"thread_name\", \"ph\": \"M\", \"pid\": 0, \"tid\": %d, \"args\": {\"name\": \"process %d\"}}", first ? "" : ",\n", r, r);
+    first = 0;
+    for(int i = 0; i < counts[r]; i++, e++)	{
+      fprintf(fptr, ",\n{\"name\": \"%s\", \"cat\": \"mpi\", \"ph\": \"X\", \"pid\": 0, \"tid\": %d, \"ts\": %.3lf, \"dur\": %.3lf, \"args\": {\"bytes\": %.0lf}}",
+	      call_names[e->call], r, e->start * 1.0e6, e->duration * 1.0e6, e->bytes);
+      if (e->wait > 0.0)
+	fprintf(fptr, ",\n{\"name\": \"wait\", \"cat\": \"wait\", \"ph\": \"X\", \"pid\": 0, \"tid\": %d, \"ts\": %.3lf, \"dur\": %.3lf}",
+		r, e->start * 1.0e6, e->wait * 1.0e6);
+    }
+  }
+  fprintf(fptr, "\n]}\n");
+  fclose(fptr);
+  return;
+}
+
+int MPI_Finalize(void)	{
+  int my_id, nprocs, event_bytes, *counts = NULL, *displs = NULL;
+  double local[4*NCALLS], sum[4*NCALLS], times[NCALLS], min_time[NCALLS], max_time[NCALLS];
+  double rank_time[3], *rank_times = NULL, wall, total_dropped, dropped = (double)dropped_events;
+  event_t *all_events = NULL;
+
+  wall = PMPI_Wtime() - t_origin;
+  PMPI_Comm_rank(MPI_COMM_WORLD, &my_id);
+  PMPI_Comm_size(MPI_COMM_WORLD, &nprocs);
+
+  rank_time[1] = rank_time[2] = 0.0;
+  for(int c = 0; c < NCALLS; c++)	{
+    local[4*c] = stats[c].count;
+    local[4*c+1] = stats[c].bytes;
+    local[4*c+2] = times[c] = stats[c].time;
+    local[4*c+3] = stats[c].wait;
+    rank_time[1] += stats[c].time;
+    rank_time[2] += stats[c].wait;
+  }
+  rank_time[0] = wall - rank_time[1];
+
+  if (my_id == 0) rank_times = malloc(3 * nprocs * sizeof(double));
+  PMPI_Reduce(local, sum, 4*NCALLS, MPI_DOUBLE, MPI_SUM, 0, MPI_COMM_WORLD);
+  PMPI_Reduce(times, min_time, NCALLS, MPI_DOUBLE, MPI_MIN, 0, MPI_COMM_WORLD);
+  PMPI_Reduce(times, max_time, NCALLS, MPI_DOUBLE, MPI_MAX, 0, MPI_COMM_WORLD);
+  PMPI_Reduce(&dropped, &total_dropped, 1, MPI_DOUBLE, MPI_SUM, 0, MPI_COMM_WORLD);
+  PMPI_Gather(rank_time, 3, MPI_DOUBLE, rank_times, 3, MPI_DOUBLE, 0, MPI_COMM_WORLD);
+
+  if (my_id == 0)	{
+    printf("\n---------MPI profile: %d processes, wall time = %lf (%s)---------\n", nprocs, wall,
+	   wait_mode ? "wait = barrier before collectives, probe before receives" : "wait measured in MPI_Wait/MPI_Barrier only");
+    print_call_table(sum, min_time, max_time, nprocs);
+    print_imbalance(rank_times, nprocs);
+    free(rank_times);
+  }
+
+  if (trace_file[0] != '\0')	{	/* the timelines of all processes are collected on the root */
+    event_bytes = nevents * (int)sizeof(event_t);
+    if (my_id == 0)	{
+      counts = malloc(nprocs * sizeof(int));
+      displs = malloc(nprocs * sizeof(int));
+    }
+    PMPI_Gather(&event_bytes, 1, MPI_INT, counts, 1, MPI_INT, 0, MPI_COMM_WORLD);
+    if (my_id == 0)	{
+      displs[0] = 0;
+      for(int r = 1; r < nprocs; r++) displs[r] = displs[r-1] + counts[r-1];
+      all_events = malloc(displs[nprocs-1] + counts[nprocs-1] + 1);
+    }
+    PMPI_Gatherv(events, event_bytes, MPI_BYTE, all_events, counts, displs, MPI_BYTE, 0, MPI_COMM_WORLD);
+    if (my_id == 0)	{
+      for(int r = 0; r < nprocs; r++) counts[r] /= (int)sizeof(event_t);
+      write_trace(all_events, counts, nprocs);
+      printf("Timeline written to %s", trace_file);
+      if (total_dropped > 0.0) printf(" (%.0lf calls beyond MPIPROF_MAX_EVENTS per process are only counted)", total_dropped);
+      printf("\n");
+      free(all_events);
+      free(counts);
+      free(displs);
+    }
+  }
+
+  free(events);
+  return PMPI_Finalize();
+}